@@ -6,6 +6,12 @@ from enum import Enum, auto
 from dataclasses import dataclass
 from typing import Optional
 
+# компилированные ядра (old/python/_inti.c), если собраны
+try:
+    import _inti
+except ImportError:
+    _inti = None
+
 # Константы
 INTI_BASEKEY = 0xA1B34F58CAD705B2
 INTI_CONST1 = 141
@@ -46,6 +52,9 @@ FILE_TYPES = [
 ]
 
 def inti_keygen(password: str) -> int:
+    if _inti:
+        return _inti.keygen(password)
+
     key = INTI_BASEKEY
     for c in password:
         key += ord(c)
@@ -53,6 +62,10 @@ def inti_keygen(password: str) -> int:
     return key & 0xFFFFFFFFFFFFFFFF
 
 def inti_encdec(buffer: bytearray, mode: EncDecMode, key: int) -> None:
+    if _inti:
+        _inti.encdec(buffer, 0 if mode == EncDecMode.ENCODE else 1, key)
+        return
+
     blockkey = key
     for i in range(len(buffer)):
         tmp = buffer[i]
@@ -0,0 +1,580 @@
+//
+// benchmarks for keygen, the scramble kernels, the deflate backends and the full
+// filetype conversions, one-shot (d/e) and streamed (sd/se)
+//
+// output is one CSV line per measurement:
+//   bench,variant,bytes,iterations,seconds,mb_per_s
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+#ifndef _MSC_VER
+ #include <strings.h>
+ #define stricmp strcasecmp
+#endif
+
+#include "encdec.h"
+#include "mtdec.h"
+#include "filetypes.h"
+#include "stream.h"
+#include "mmfiles.h"
+#include "zback.h"
+#include "pzlib.h"
+#include "pipeline.h"
+#include "libinti.h"
+
+typedef uint8_t byte;
+
+#define MINTIME 0.25 // seconds each measurement runs for, at least one iteration
+
+static double mintime = MINTIME;
+static const char *filter = NULL;
+
+static double now (void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER freq, count;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / freq.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+static void report (const char *bench, const char *variant, uint64_t bytes, int iters, double secs)
+{
+  printf("%s,%s,%"PRIu64",%i,%.6f,%.2f\n", bench, variant, bytes, iters, secs,
+         secs > 0 ? (double)bytes*iters/secs/1e6 : 0.0);
+  fflush(stdout);
+}
+
+static int wanted (const char *bench)
+{
+  return !filter || strstr(bench, filter) != NULL;
+}
+
+// compressible pseudo text, roughly like the JSON/text assets
+static void fill_synthetic (byte *buf, size_t len, uint32_t seed)
+{
+  static const char *words[] = { "\"name\"", ":", "{", "}", ",", "\"id\"", "0", "12", "true", " ",
+                                 "\n", "stage", "enemy", "\"text\"", "[", "]", "Gunvolt", "90210" };
+  size_t i, w;
+
+  for (i=0; i<len; )
+  {
+    const char *word;
+
+    seed = seed*1103515245 + 12345;
+    word = words[(seed >> 16) % (sizeof(words)/sizeof(words[0]))];
+
+    for (w=0; word[w] && i<len; w++)
+      buf[i++] = word[w];
+  }
+}
+
+//
+// kernels
+//
+
+static void bench_keygen (void)
+{
+  static const char *pwd = "txt20170401";
+  volatile uint64_t sink = 0;
+  double start, secs;
+  int iters;
+
+  if (!wanted("keygen"))
+    return;
+
+  iters = 0;
+  start = now();
+  do
+  {
+    int i;
+
+    for (i=0; i<10000; i++)
+      sink += inti_keygen(pwd);
+
+    iters += 10000;
+    secs = now()-start;
+  }
+  while (secs < mintime);
+
+  report("keygen", pwd, strlen(pwd), iters, secs);
+}
+
+typedef enum
+{
+  K_ENC,
+  K_DEC,
+  K_DEC_MT,
+  K_ENC2,
+  K_DEC2
+}
+kernel_t;
+
+static void bench_kernel (const char *bench, const char *variant, kernel_t kernel, byte *buf, size_t len)
+{
+  uint64_t key1, key2;
+  double start, secs;
+  int iters;
+
+  if (!wanted(bench))
+    return;
+
+  key1 = inti_keygen("xN5sUeRo");
+  key2 = inti_keygen("zZ2c9VTK");
+
+  iters = 0;
+  start = now();
+  do
+  {
+    switch (kernel)
+    {
+      case K_ENC:    inti_enc_from(buf, len, key1, 0); break;
+      case K_DEC:    inti_dec_from(buf, len, key1, 0); break;
+      case K_DEC_MT: inti_dec_mt(buf, len, key1, 0); break;
+      case K_ENC2:   inti_encdec2(buf, ENCDEC_MODE_ENC, len, key1, key2); break;
+      case K_DEC2:   inti_encdec2(buf, ENCDEC_MODE_DEC, len, key1, key2); break;
+    }
+
+    iters++;
+    secs = now()-start;
+  }
+  while (secs < mintime);
+
+  report(bench, variant, len, iters, secs);
+}
+
+static void bench_kernels (byte *buf, size_t len)
+{
+  static const char *simdnames[] = { "scalar", "avx2" };
+  int level, best;
+
+  bench_kernel("enc", "scalar", K_ENC, buf, len);
+
+  best = inti_dec_get_simd();
+  for (level=INTI_SIMD_NONE; level<=best; level++)
+  {
+    inti_dec_set_simd(level);
+    bench_kernel("dec", simdnames[level], K_DEC, buf, len);
+  }
+  inti_dec_set_simd(best);
+
+  bench_kernel("dec_mt", simdnames[best], K_DEC_MT, buf, len);
+  bench_kernel("enc2", "scalar", K_ENC2, buf, len);
+  bench_kernel("dec2", simdnames[best], K_DEC2, buf, len);
+}
+
+//
+// deflate stages through zback, every available backend at a few levels
+//
+
+static void bench_zback (byte *buf, size_t len)
+{
+  static const char *levels[] = { "fast", "default", "max" };
+  char variant[64];
+  byte *zbuf, *ubuf;
+  size_t zlen, ulen, bound;
+  double start, secs;
+  int b, l, iters, r;
+
+  if (!wanted("compress") && !wanted("uncompress"))
+    return;
+
+  for (b=0; b<ZBACK_COUNT; b++)
+  {
+    if (!zback_available(b))
+      continue;
+
+    zback_select(zback_name(b));
+    bound = zback_bound(len);
+    zbuf = malloc(bound);
+    ubuf = malloc(len ? len : 1);
+    if (!zbuf || !ubuf)
+    {
+      printf("# failed to allocate zlib buffers for %zu bytes\n", len);
+      free(zbuf);
+      free(ubuf);
+      break;
+    }
+
+    for (l=0; l<(int)(sizeof(levels)/sizeof(levels[0])); l++)
+    {
+      zback_set_level(levels[l]);
+      snprintf(variant, sizeof(variant), "%s_%s%i", zback_name(b), levels[l], zback_level());
+
+      r = Z_OK;
+      iters = 0;
+      start = now();
+      do
+      {
+        zlen = bound;
+        r = zback_compress(zbuf, &zlen, buf, len, zback_level());
+        iters++;
+        secs = now()-start;
+      }
+      while (secs < mintime && r == Z_OK);
+
+      if (r != Z_OK)
+      {
+        printf("# compress %s failed, error code %i\n", variant, r);
+        continue;
+      }
+
+      if (wanted("compress"))
+        report("compress", variant, len, iters, secs);
+
+      // inflating doesn't depend on the level much, once per backend is enough
+      if (l != 1 || !wanted("uncompress"))
+        continue;
+
+      iters = 0;
+      start = now();
+      do
+      {
+        ulen = len;
+        r = zback_uncompress(ubuf, &ulen, zbuf, zlen);
+        iters++;
+        secs = now()-start;
+      }
+      while (secs < mintime && r == Z_OK);
+
+      if (r != Z_OK)
+        printf("# uncompress %s failed, error code %i\n", zback_name(b), r);
+      else
+        report("uncompress", zback_name(b), len, iters, secs);
+    }
+
+    free(zbuf);
+    free(ubuf);
+  }
+
+  zback_select(zback_name(INTI_DEFAULT_ZBACK));
+  zback_set_level("default");
+}
+
+//
+// end to end, every filetype through the one-shot converter (d/e) and the
+// streaming one (sd/se), both including file I/O
+//
+
+static void filetype_keys (const inti_filetype_t *predef, uint64_t *key1, uint64_t *key2)
+{
+  char pwdbuf[64];
+
+  if (predef->need_steamid)
+  {
+    snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", predef->password1, 0x12345678);
+    *key1 = inti_keygen(pwdbuf);
+    snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", predef->password2, 0x12345678);
+    *key2 = inti_keygen(pwdbuf);
+  }
+  else
+  {
+    *key1 = inti_keygen(predef->password1);
+    *key2 = predef->password2 ? inti_keygen(predef->password2) : 0;
+  }
+}
+
+// the stages of inti_encdec d/e (main.c) on memory mapped files, without the messages
+static int convert_mapped (char *inpath, char *outpath, int encode, const inti_filetype_t *predef, uint64_t key1, uint64_t key2)
+{
+  mmapinfo_t *in, *out;
+  inti_cspan_t cin;
+  inti_span_t cout;
+  uint32_t unzsize;
+  size_t zsize, outlen;
+  int compressed, headerskip, r;
+  byte *source;
+
+  compressed = predef->compressed;
+  headerskip = predef->headerskip;
+
+  in = mmap_existing_read(inpath);
+  if (!in)
+    return -1;
+
+  if (in->size < (size_t)headerskip || (compressed && !encode && in->size < sizeof(uint32_t)))
+  {
+    close_mmapping(in);
+    return -1;
+  }
+
+  if (compressed && encode && zback_current() == ZBACK_ZLIB && in->size > 2*PZ_BLOCKSIZE)
+  {
+    close_mmapping(in);
+    return inti_pipeline_encode(inpath, outpath, compressed, key1, key2, 0, NULL, NULL);
+  }
+
+  r = 0;
+  if (!compressed)
+  {
+    out = mmap_create_overwrite(outpath, in->size);
+    if (!out)
+    {
+      close_mmapping(in);
+      return -1;
+    }
+
+    memcpy(out->ptr, in->ptr, in->size);
+
+    if (encode && key2)
+      inti_encdec2((byte*)out->ptr+headerskip, ENCDEC_MODE_ENC, in->size-headerskip, key1, key2);
+    else if (encode)
+      inti_encdec((byte*)out->ptr+headerskip, ENCDEC_MODE_ENC, in->size-headerskip, key1);
+    else if (key2)
+      inti_dec2_mt((byte*)out->ptr+headerskip, in->size-headerskip, key1, key2, 0);
+    else
+      inti_dec_mt((byte*)out->ptr+headerskip, in->size-headerskip, key1, 0);
+
+    close_mmapping(out);
+  }
+  else if (!encode)
+  {
+    byte header[sizeof(uint32_t)];
+
+    // the size header is scrambled along with the rest for COMP_YES
+    memcpy(header, in->ptr, sizeof(uint32_t));
+    if (compressed == COMP_YES && key2)
+      inti_encdec2(header, ENCDEC_MODE_DEC, sizeof(uint32_t), key1, key2);
+    else if (compressed == COMP_YES)
+      inti_encdec(header, ENCDEC_MODE_DEC, sizeof(uint32_t), key1);
+
+    memcpy(&unzsize, header, sizeof(uint32_t));
+    outlen = unzsize;
+
+    cin.ptr = in->ptr;
+    cin.len = in->size;
+
+    out = mmap_create_overwrite(outpath, outlen);
+    if (!out)
+    {
+      close_mmapping(in);
+      return -1;
+    }
+
+    cout.ptr = out->ptr;
+    cout.len = outlen;
+
+    if (compressed == COMP_REVERSE)
+    {
+      r = zback_uncompress(cout.ptr, &outlen, (byte*)in->ptr+sizeof(uint32_t), in->size-sizeof(uint32_t)) != Z_OK;
+      if (!r && key2)
+        inti_dec2_mt(cout.ptr, outlen, key1, key2, 0);
+      else if (!r)
+        inti_dec_mt(cout.ptr, outlen, key1, 0);
+    }
+    else
+      r = inti_decode_keys(compressed, 0, key1, key2, cin, cout, &outlen) != INTI_OK;
+
+    close_mmapping(out);
+  }
+  else
+  {
+    source = in->ptr;
+    if (compressed == COMP_REVERSE)
+    {
+      source = malloc(in->size ? in->size : 1);
+      if (!source)
+      {
+        close_mmapping(in);
+        return -1;
+      }
+
+      memcpy(source, in->ptr, in->size);
+
+      if (key2)
+        inti_encdec2(source, ENCDEC_MODE_ENC, in->size, key1, key2);
+      else
+        inti_encdec(source, ENCDEC_MODE_ENC, in->size, key1);
+    }
+
+    zsize = zback_bound(in->size);
+    out = mmap_create_overwrite(outpath, zsize+sizeof(uint32_t));
+    if (out)
+    {
+      r = zback_compress((byte*)out->ptr+sizeof(uint32_t), &zsize, source, in->size, zback_level()) != Z_OK;
+
+      unzsize = in->size;
+      memcpy(out->ptr, &unzsize, sizeof(uint32_t));
+
+      if (!r && compressed == COMP_YES && key2)
+        inti_encdec2(out->ptr, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key1, key2);
+      else if (!r && compressed == COMP_YES)
+        inti_encdec(out->ptr, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key1);
+
+      if (close_mmapping_truncate(out, zsize+sizeof(uint32_t)))
+        r = -1;
+    }
+    else
+      r = -1;
+
+    if (source != in->ptr)
+      free(source);
+  }
+
+  close_mmapping(in);
+  return r ? -1 : 0;
+}
+
+static void bench_conversions (const char *tmpdir, byte *buf, size_t len)
+{
+  static const char *names[2][2] = { { "file_d", "file_e" }, { "stream_d", "stream_e" } };
+  char plainpath[1024], encpath[1024], decpath[1024];
+  FILE *fp;
+  int i, count, streamed;
+
+  if (!wanted("file_") && !wanted("stream_"))
+    return;
+
+  snprintf(plainpath, sizeof(plainpath), "%s/inti_bench_plain.bin", tmpdir);
+  snprintf(encpath, sizeof(encpath), "%s/inti_bench_enc.bin", tmpdir);
+  snprintf(decpath, sizeof(decpath), "%s/inti_bench_dec.bin", tmpdir);
+
+  fp = fopen(plainpath, "wb");
+  if (!fp || fwrite(buf, 1, len, fp) != len)
+  {
+    printf("# failed to write '%s'\n", plainpath);
+    if (fp)
+      fclose(fp);
+    return;
+  }
+  fclose(fp);
+
+  count = CountFileTypes();
+  for (streamed=0; streamed<2; streamed++)
+  {
+    if (!wanted(names[streamed][0]) && !wanted(names[streamed][1]))
+      continue;
+
+    for (i=0; i<count; i++)
+    {
+      const inti_filetype_t *predef = &FileTypes[i];
+      uint64_t key1, key2;
+      double start, secs;
+      int iters, dir, failed;
+
+      filetype_keys(predef, &key1, &key2);
+
+      // encode first, the decode run needs its output
+      for (dir=1; dir>=0; dir--)
+      {
+        failed = 0;
+        iters = 0;
+        start = now();
+        do
+        {
+          if (streamed)
+            failed |= inti_stream_file(dir ? plainpath : encpath, dir ? encpath : decpath, dir, predef->compressed, predef->headerskip, key1, key2, NULL, NULL);
+          else
+            failed |= convert_mapped(dir ? plainpath : encpath, dir ? encpath : decpath, dir, predef, key1, key2);
+
+          iters++;
+          secs = now()-start;
+        }
+        while (secs < mintime && !failed);
+
+        if (failed)
+          printf("# %s %s failed\n", names[streamed][dir], predef->shorthand);
+        else if (wanted(names[streamed][dir]))
+          report(names[streamed][dir], predef->shorthand, len, iters, secs);
+      }
+    }
+  }
+
+  remove(plainpath);
+  remove(encpath);
+  remove(decpath);
+}
+
+static void ShowUsage (void)
+{
+  printf("usage: inti_bench [-min <bytes>] [-max <bytes>] [-time <seconds>] [-only <name>] [-tmp <dir>]\n"\
+         "        sizes go from min to max (default 1 KB .. 64 MB) in steps of x8,\n"\
+         "        use -max 1073741824 for the full 1 GB run\n");
+  exit(-1);
+}
+
+int main (int argc, char **argv)
+{
+  size_t minsize, maxsize, len;
+  const char *tmpdir;
+  byte *src, *buf;
+  int i;
+
+  minsize = 1024;
+  maxsize = 64*1024*1024;
+  tmpdir = ".";
+
+  for (i=1; i<argc; i++)
+  {
+    if (i+1 >= argc)
+      ShowUsage();
+
+    if (!stricmp(argv[i], "-min"))
+      minsize = strtoull(argv[++i], NULL, 0);
+    else if (!stricmp(argv[i], "-max"))
+      maxsize = strtoull(argv[++i], NULL, 0);
+    else if (!stricmp(argv[i], "-time"))
+      mintime = atof(argv[++i]);
+    else if (!stricmp(argv[i], "-only"))
+      filter = argv[++i];
+    else if (!stricmp(argv[i], "-tmp"))
+      tmpdir = argv[++i];
+    else
+      ShowUsage();
+  }
+
+  if (!minsize || maxsize < minsize)
+    ShowUsage();
+
+  src = malloc(maxsize);
+  buf = malloc(maxsize);
+  if (!src || !buf)
+  {
+    printf("failed to allocate %zu bytes for test data\n", maxsize);
+    return -1;
+  }
+
+  fill_synthetic(src, maxsize, 1);
+
+  printf("bench,variant,bytes,iterations,seconds,mb_per_s\n");
+
+  bench_keygen();
+
+  for (len=minsize; len<=maxsize; len*=8)
+  {
+    memcpy(buf, src, len);
+    bench_kernels(buf, len);
+
+    bench_zback(src, len);
+    bench_conversions(tmpdir, src, len);
+
+    if (len > maxsize/8 && len != maxsize)
+      len = maxsize/8; // always end on maxsize
+  }
+
+  free(src);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,83 @@
+//
+// CPython extension with the C scramble kernels for inti_encdec.py and textconv.py
+//
+// encdec() works in place on any writable buffer (bytearray, memoryview, mmap)
+// with the GIL released, decoding on all cpus for big buffers like the CLI does.
+// the scripts fall back to their pure python loops when this isn't built
+//
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encdec.h"
+#include "mtdec.h"
+
+static PyObject *py_keygen (PyObject *self, PyObject *args)
+{
+  const char *password;
+
+  if (!PyArg_ParseTuple(args, "s", &password))
+    return NULL;
+
+  return PyLong_FromUnsignedLongLong(inti_keygen(password));
+}
+
+static PyObject *py_encdec (PyObject *self, PyObject *args)
+{
+  Py_buffer view;
+  PyObject *keyobj;
+  uint64_t key;
+  int mode;
+
+  if (!PyArg_ParseTuple(args, "w*iO", &view, &mode, &keyobj))
+    return NULL;
+
+  // the scripts keep keys masked to 64 bits, but take any int like they would
+  key = PyLong_AsUnsignedLongLongMask(keyobj);
+  if (PyErr_Occurred())
+  {
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+
+  if (mode != ENCDEC_MODE_ENC && mode != ENCDEC_MODE_DEC)
+  {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "mode must be 0 (encode) or 1 (decode)");
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+
+  if (mode == ENCDEC_MODE_DEC)
+    inti_dec_mt(view.buf, view.len, key, 0);
+  else
+    inti_enc_from(view.buf, view.len, key, 0);
+
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&view);
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef methods[] =
+{
+  { "keygen", py_keygen, METH_VARARGS, "keygen(password) -> key, same as inti_keygen()" },
+  { "encdec", py_encdec, METH_VARARGS, "encdec(buffer, mode, key), scrambles (mode 0) or descrambles (mode 1) a writable buffer in place" },
+  { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef module =
+{
+  PyModuleDef_HEAD_INIT, "_inti", "INTI scramble kernels", -1, methods
+};
+
+PyMODINIT_FUNC PyInit__inti (void)
+{
+  inti_dec_get_simd(); // set up the kernel tables while there's only one thread
+
+  return PyModule_Create(&module);
+}
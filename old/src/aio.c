@@ -0,0 +1,480 @@
+//
+// asynchronous file reads and writes for many small files
+//
+// with io_uring, a whole wave of reads or writes goes to the kernel with one
+// io_uring_enter() and the caller can convert other files while they are in
+// flight (aio_submit). the rings are set up with the raw syscalls from <linux/io_uring.h>,
+// so there is no dependency on liburing. everywhere else (and if the kernel
+// has io_uring disabled) requests are queued and carried out with pread/pwrite
+// when they are waited for, which keeps the callers the same but means nothing
+// overlaps: the I/O runs serially on the waiting thread
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+#else
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && !defined(INTI_NO_URING)
+  #define INTI_URING
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <linux/io_uring.h>
+#endif
+
+#include "aio.h"
+
+#define MAXTRANSFER (1 << 30) // per read/write, both interfaces return at most about this much
+
+enum
+{
+  OP_READ,
+  OP_WRITE
+};
+
+typedef struct
+{
+  int op;
+  int fd;
+  uint8_t *buf;
+  size_t len, done;
+  uint64_t offset;
+  void *tag;
+  int next; // free list, or queue for the pread backend
+}
+aioreq_t;
+
+struct aio_s
+{
+  aioreq_t *reqs;
+  int depth;
+  int freelist;
+  int inflight;
+  int queuehead, queuetail; // pread backend, oldest first
+
+#ifdef INTI_URING
+  int ringfd; // -1 for the pread backend
+  void *sqring, *cqring;
+  size_t sqringsize, cqringsize, sqesize;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned tosubmit;
+#endif
+};
+
+#ifdef INTI_URING
+
+static int uring_setup (aio_t *a)
+{
+  struct io_uring_params p;
+  int single;
+
+  memset(&p, 0, sizeof(p));
+  a->ringfd = (int)syscall(__NR_io_uring_setup, (unsigned)a->depth, &p);
+  if (a->ringfd < 0)
+    return -1;
+
+  a->sqringsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  a->cqringsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  a->sqesize = p.sq_entries*sizeof(struct io_uring_sqe);
+
+  // newer kernels map both rings with one mmap
+  single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && a->cqringsize > a->sqringsize)
+    a->sqringsize = a->cqringsize;
+
+  a->sqring = mmap(NULL, a->sqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, a->ringfd, IORING_OFF_SQ_RING);
+  if (a->sqring == MAP_FAILED)
+    goto fail;
+
+  a->cqring = a->sqring;
+  if (!single)
+  {
+    a->cqring = mmap(NULL, a->cqringsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, a->ringfd, IORING_OFF_CQ_RING);
+    if (a->cqring == MAP_FAILED)
+    {
+      munmap(a->sqring, a->sqringsize);
+      goto fail;
+    }
+  }
+
+  a->sqes = mmap(NULL, a->sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, a->ringfd, IORING_OFF_SQES);
+  if (a->sqes == MAP_FAILED)
+  {
+    if (!single)
+      munmap(a->cqring, a->cqringsize);
+    munmap(a->sqring, a->sqringsize);
+    goto fail;
+  }
+
+  a->sqhead = (unsigned *)((char *)a->sqring + p.sq_off.head);
+  a->sqtail = (unsigned *)((char *)a->sqring + p.sq_off.tail);
+  a->sqmask = (unsigned *)((char *)a->sqring + p.sq_off.ring_mask);
+  a->sqarray = (unsigned *)((char *)a->sqring + p.sq_off.array);
+  a->cqhead = (unsigned *)((char *)a->cqring + p.cq_off.head);
+  a->cqtail = (unsigned *)((char *)a->cqring + p.cq_off.tail);
+  a->cqmask = (unsigned *)((char *)a->cqring + p.cq_off.ring_mask);
+  a->cqes = (struct io_uring_cqe *)((char *)a->cqring + p.cq_off.cqes);
+  a->tosubmit = 0;
+
+  return 0;
+
+fail:
+  close(a->ringfd);
+  a->ringfd = -1;
+  return -1;
+}
+
+static void uring_teardown (aio_t *a)
+{
+  munmap(a->sqes, a->sqesize);
+  if (a->cqring != a->sqring)
+    munmap(a->cqring, a->cqringsize);
+  munmap(a->sqring, a->sqringsize);
+  close(a->ringfd);
+}
+
+// puts the rest of a request into the submission ring, io_uring_enter() sends it later
+static void uring_queue (aio_t *a, int i)
+{
+  aioreq_t *r = &a->reqs[i];
+  struct io_uring_sqe *sqe;
+  unsigned tail, index;
+  size_t n;
+
+  tail = *a->sqtail; // only this thread writes the tail
+  index = tail & *a->sqmask;
+
+  n = r->len - r->done;
+  if (n > MAXTRANSFER)
+    n = MAXTRANSFER;
+
+  sqe = &a->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = (r->op == OP_READ) ? IORING_OP_READ : IORING_OP_WRITE;
+  sqe->fd = r->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(r->buf + r->done);
+  sqe->len = (unsigned)n;
+  sqe->off = r->offset + r->done;
+  sqe->user_data = (uint64_t)i;
+
+  a->sqarray[index] = index;
+  __atomic_store_n(a->sqtail, tail+1, __ATOMIC_RELEASE);
+  a->tosubmit++;
+}
+
+static void uring_submit (aio_t *a)
+{
+  int ret;
+
+  while (a->tosubmit)
+  {
+    ret = (int)syscall(__NR_io_uring_enter, a->ringfd, a->tosubmit, 0, 0, NULL, 0);
+    if (ret < 0 && errno == EINTR)
+      continue;
+
+    // EAGAIN/EBUSY and the like: leave the rest for uring_wait
+    if (ret <= 0)
+      break;
+
+    a->tosubmit -= (unsigned)ret < a->tosubmit ? (unsigned)ret : a->tosubmit;
+  }
+}
+
+static int uring_wait (aio_t *a, int *index, int64_t *result)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  aioreq_t *r;
+  int ret, i;
+
+  for (;;)
+  {
+    head = *a->cqhead;
+    if (head == __atomic_load_n(a->cqtail, __ATOMIC_ACQUIRE))
+    {
+      // submit whatever is queued and sleep until something completes
+      ret = (int)syscall(__NR_io_uring_enter, a->ringfd, a->tosubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (ret < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        return -1;
+      }
+
+      a->tosubmit -= (unsigned)ret < a->tosubmit ? (unsigned)ret : a->tosubmit;
+      continue;
+    }
+
+    cqe = &a->cqes[head & *a->cqmask];
+    i = (int)cqe->user_data;
+    ret = cqe->res;
+    __atomic_store_n(a->cqhead, head+1, __ATOMIC_RELEASE);
+
+    r = &a->reqs[i];
+
+    if (ret == -EAGAIN || ret == -EINTR)
+    {
+      uring_queue(a, i);
+      continue;
+    }
+
+    if (ret > 0)
+    {
+      r->done += ret;
+
+      // short transfer, carry on with the rest unless a read hit the end of the file
+      if (r->done < r->len)
+      {
+        uring_queue(a, i);
+        continue;
+      }
+    }
+
+    *index = i;
+    *result = (ret < 0) ? ret : (int64_t)r->done;
+    return 0;
+  }
+}
+
+#endif // INTI_URING
+
+static int64_t transfer (aioreq_t *r)
+{
+  int64_t n;
+  size_t chunk;
+
+  while (r->done < r->len)
+  {
+    chunk = r->len - r->done;
+    if (chunk > MAXTRANSFER)
+      chunk = MAXTRANSFER;
+
+#ifdef _WIN32
+    // the pread backend only ever runs on the waiting thread, so seek+read is fine
+    if (_lseeki64(r->fd, (__int64)(r->offset + r->done), SEEK_SET) < 0)
+      return -errno;
+
+    n = (r->op == OP_READ) ? _read(r->fd, r->buf + r->done, (unsigned)chunk) : _write(r->fd, r->buf + r->done, (unsigned)chunk);
+#else
+    n = (r->op == OP_READ) ? pread(r->fd, r->buf + r->done, chunk, (off_t)(r->offset + r->done))
+                           : pwrite(r->fd, r->buf + r->done, chunk, (off_t)(r->offset + r->done));
+#endif
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return -errno;
+    }
+
+    if (!n)
+      break; // end of file
+
+    r->done += n;
+  }
+
+  return r->done;
+}
+
+aio_t *aio_create (int depth)
+{
+  aio_t *a;
+  int i;
+
+  a = calloc(1, sizeof(aio_t));
+  if (!a)
+    return NULL;
+
+  a->reqs = malloc(sizeof(aioreq_t)*depth);
+  if (!a->reqs)
+  {
+    free(a);
+    return NULL;
+  }
+
+  a->depth = depth;
+  for (i=0; i<depth; i++)
+    a->reqs[i].next = i+1;
+  a->reqs[depth-1].next = -1;
+  a->freelist = 0;
+  a->queuehead = a->queuetail = -1;
+
+#ifdef INTI_URING
+  if (uring_setup(a))
+    a->ringfd = -1;
+#endif
+
+  return a;
+}
+
+void aio_destroy (aio_t *a)
+{
+  void *tag;
+  int64_t result;
+
+  // buffers may still be in the kernel's hands
+  while (a->inflight)
+    aio_wait(a, &tag, &result);
+
+#ifdef INTI_URING
+  if (a->ringfd >= 0)
+    uring_teardown(a);
+#endif
+
+  free(a->reqs);
+  free(a);
+}
+
+const char *aio_name (aio_t *a)
+{
+#ifdef INTI_URING
+  if (a->ringfd >= 0)
+    return "io_uring";
+#endif
+
+  return "pread";
+}
+
+int aio_open_read (const char *path)
+{
+#ifdef _WIN32
+  return _open(path, _O_RDONLY|_O_BINARY);
+#else
+  return open(path, O_RDONLY);
+#endif
+}
+
+int aio_open_write (const char *path)
+{
+  remove(path); // may be a hardlink into the conversion cache
+
+#ifdef _WIN32
+  return _open(path, _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE);
+#else
+  return open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+#endif
+}
+
+int aio_close (int fd)
+{
+#ifdef _WIN32
+  return _close(fd);
+#else
+  return close(fd);
+#endif
+}
+
+static int enqueue (aio_t *a, int op, int fd, void *buf, size_t len, uint64_t offset, void *tag)
+{
+  aioreq_t *r;
+  int i;
+
+  if (a->freelist < 0)
+    return -1;
+
+  i = a->freelist;
+  r = &a->reqs[i];
+  a->freelist = r->next;
+
+  r->op = op;
+  r->fd = fd;
+  r->buf = buf;
+  r->len = len;
+  r->done = 0;
+  r->offset = offset;
+  r->tag = tag;
+  r->next = -1;
+
+  a->inflight++;
+
+#ifdef INTI_URING
+  if (a->ringfd >= 0)
+  {
+    uring_queue(a, i);
+    return 0;
+  }
+#endif
+
+  if (a->queuetail >= 0)
+    a->reqs[a->queuetail].next = i;
+  else
+    a->queuehead = i;
+  a->queuetail = i;
+
+  return 0;
+}
+
+int aio_read (aio_t *a, int fd, void *buf, size_t len, uint64_t offset, void *tag)
+{
+  return enqueue(a, OP_READ, fd, buf, len, offset, tag);
+}
+
+int aio_write (aio_t *a, int fd, const void *buf, size_t len, uint64_t offset, void *tag)
+{
+  return enqueue(a, OP_WRITE, fd, (void *)buf, len, offset, tag);
+}
+
+void aio_submit (aio_t *a)
+{
+#ifdef INTI_URING
+  if (a->ringfd >= 0)
+    uring_submit(a);
+#endif
+
+  (void)a; // the pread backend does its I/O in aio_wait
+}
+
+int aio_wait (aio_t *a, void **tag, int64_t *result)
+{
+  int i;
+
+  if (!a->inflight)
+    return -1;
+
+#ifdef INTI_URING
+  if (a->ringfd >= 0)
+  {
+    if (uring_wait(a, &i, result))
+      return -1;
+  }
+  else
+#endif
+  {
+    i = a->queuehead;
+    a->queuehead = a->reqs[i].next;
+    if (a->queuehead < 0)
+      a->queuetail = -1;
+
+    *result = transfer(&a->reqs[i]);
+  }
+
+  *tag = a->reqs[i].tag;
+
+  a->reqs[i].next = a->freelist;
+  a->freelist = i;
+  a->inflight--;
+
+  return 0;
+}
+
+int aio_inflight (aio_t *a)
+{
+  return a->inflight;
+}
@@ -0,0 +1,39 @@
+//
+// asynchronous file reads and writes for many small files, header
+//
+
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct aio_s aio_t;
+
+// depth is the most requests that may be in flight at once. uses io_uring on linux
+// (unless built with -DINTI_NO_URING or the kernel refuses), otherwise requests are
+// carried out with pread/pwrite one by one as they are waited for
+extern aio_t *aio_create (int depth);
+extern void aio_destroy (aio_t *a);
+extern const char *aio_name (aio_t *a); // "io_uring" or "pread"
+
+// -1 on failure
+extern int aio_open_read (const char *path);
+extern int aio_open_write (const char *path); // replaces
+extern int aio_close (int fd);
+
+// queue a request, returns -1 if depth requests are already in flight. tag is handed
+// back by aio_wait. short transfers are continued internally, so a request completes
+// with len bytes, fewer at end of file, or -errno
+extern int aio_read (aio_t *a, int fd, void *buf, size_t len, uint64_t offset, void *tag);
+extern int aio_write (aio_t *a, int fd, const void *buf, size_t len, uint64_t offset, void *tag);
+
+// hands what is queued to the kernel without waiting, so it is in flight while the
+// caller does other work. failures show up at aio_wait, which submits again
+extern void aio_submit (aio_t *a);
+
+// submits what is queued and waits for one request to complete, returns -1 if none is in flight
+extern int aio_wait (aio_t *a, void **tag, int64_t *result);
+extern int aio_inflight (aio_t *a);
+
+#endif // __AIO_H__
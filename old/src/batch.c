@@ -0,0 +1,688 @@
+//
+// batch conversion of whole directory trees
+//
+// the input tree is walked once to collect all files with a known extension
+// (when decoding, files without one are recognized by their first bytes), the
+// output directories are created on the way, then the files are converted
+// on the work-stealing pool, largest first so no big file is left for last
+//
+// small files are not worth a thread each to open, read, convert and write one
+// at a time, there the syscalls and waiting on the disk dominate. they are read
+// whole in waves through aio (io_uring where there is one): while one wave is
+// converted in memory on the pool, the reads of the next wave and the writes of
+// the previous one are in flight
+//
+// with a cache directory set, files whose content was converted the same way
+// before are linked or copied from the cache instead (see cache.c)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <dirent.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+#endif
+
+#include "encdec.h"
+#include "filetypes.h"
+#include "stream.h"
+#include "threads.h"
+#include "pool.h"
+#include "aio.h"
+#include "libinti.h"
+#include "cache.h"
+#include "zback.h"
+#include "batch.h"
+
+#define BATCH_SMALLFILE (1024*1024)    // files up to this size go through the waves
+#define BATCH_WAVEFILES 256
+#define BATCH_WAVEBYTES (64*1024*1024)
+
+typedef struct
+{
+  char *inpath;
+  char *outpath;
+  uint64_t size;
+  int typeindex;
+  int failed;
+  int cached;
+}
+batchjob_t;
+
+enum
+{
+  SMALL_READING,
+  SMALL_READ,
+  SMALL_WRITING,
+  SMALL_DONE
+};
+
+typedef struct
+{
+  batchjob_t *job;
+  int state;
+  int fd;
+  uint8_t *in, *out;
+  size_t outlen;
+  double secs;
+  int caching;
+  cachekey_t cachekey;
+}
+smallfile_t;
+
+typedef struct
+{
+  batchjob_t *jobs;
+  int numjobs, maxjobs;
+  int encode;
+  mutex_t printlock;
+  smallfile_t *wave; // the one being converted
+}
+batch_t;
+
+static char *joinpath (const char *dir, const char *name)
+{
+  char *path;
+
+  path = malloc(strlen(dir) + strlen(name) + 2);
+  if (path)
+    sprintf(path, "%s/%s", dir, name);
+
+  return path;
+}
+
+static int addjob (batch_t *b, const char *inpath, const char *outpath, uint64_t size, int typeindex)
+{
+  batchjob_t *job;
+
+  if (b->numjobs == b->maxjobs)
+  {
+    batchjob_t *jobs;
+
+    b->maxjobs = b->maxjobs ? b->maxjobs*2 : 256;
+    jobs = realloc(b->jobs, sizeof(batchjob_t)*b->maxjobs);
+    if (!jobs)
+      return -1;
+
+    b->jobs = jobs;
+  }
+
+  job = &b->jobs[b->numjobs];
+  job->inpath = strdup(inpath);
+  job->outpath = strdup(outpath);
+  job->size = size;
+  job->typeindex = typeindex;
+  job->failed = 0;
+  job->cached = 0;
+
+  if (!job->inpath || !job->outpath)
+  {
+    free(job->inpath);
+    free(job->outpath);
+    return -1;
+  }
+
+  b->numjobs++;
+  return 0;
+}
+
+static int detectfile (const char *path, uint64_t size)
+{
+  uint8_t head[FILETYPE_DETECT_BYTES];
+  size_t len;
+  FILE *fp;
+
+  fp = fopen(path, "rb");
+  if (!fp)
+    return -1;
+
+  len = fread(head, 1, sizeof(head), fp);
+  fclose(fp);
+
+  return DetectFileType(head, len, size);
+}
+
+// called for every directory entry, recurses into directories
+static int walkentry (batch_t *b, const char *indir, const char *outdir, const char *name, int isdir, uint64_t size);
+
+#ifdef _WIN32
+
+static int makedir (const char *path)
+{
+  if (!CreateDirectoryA(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    return -1;
+
+  return 0;
+}
+
+static int walkdir (batch_t *b, const char *indir, const char *outdir)
+{
+  WIN32_FIND_DATAA fd;
+  HANDLE fh;
+  char *pattern;
+  int r;
+
+  pattern = joinpath(indir, "*");
+  if (!pattern)
+    return -1;
+
+  fh = FindFirstFileA(pattern, &fd);
+  free(pattern);
+  if (fh == INVALID_HANDLE_VALUE)
+    return -1;
+
+  r = 0;
+  do
+  {
+    if (!strcmp(fd.cFileName, ".") || !strcmp(fd.cFileName, ".."))
+      continue;
+
+    r = walkentry(b, indir, outdir, fd.cFileName, (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0,
+                  ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow);
+  }
+  while (!r && FindNextFileA(fh, &fd));
+
+  FindClose(fh);
+  return r;
+}
+
+#else // not _WIN32
+
+static int makedir (const char *path)
+{
+  if (mkdir(path, 0755) < 0 && errno != EEXIST)
+    return -1;
+
+  return 0;
+}
+
+static int walkdir (batch_t *b, const char *indir, const char *outdir)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct stat statbuf;
+  char *path;
+  int r;
+
+  dir = opendir(indir);
+  if (!dir)
+    return -1;
+
+  r = 0;
+  while (!r && (de = readdir(dir)) != NULL)
+  {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+      continue;
+
+    path = joinpath(indir, de->d_name);
+    if (!path)
+    {
+      r = -1;
+      break;
+    }
+
+    if (stat(path, &statbuf) == 0 && (S_ISDIR(statbuf.st_mode) || S_ISREG(statbuf.st_mode)))
+      r = walkentry(b, indir, outdir, de->d_name, S_ISDIR(statbuf.st_mode), statbuf.st_size);
+
+    free(path);
+  }
+
+  closedir(dir);
+  return r;
+}
+
+#endif // _WIN32
+
+static int walkentry (batch_t *b, const char *indir, const char *outdir, const char *name, int isdir, uint64_t size)
+{
+  char *inpath, *outpath;
+  int typeindex, r;
+
+  inpath = joinpath(indir, name);
+  outpath = joinpath(outdir, name);
+
+  typeindex = isdir ? -1 : FindFileTypeByExtension(name);
+  if (!isdir && typeindex < 0 && !b->encode && inpath)
+    typeindex = detectfile(inpath, size);
+
+  if (!inpath || !outpath)
+    r = -1;
+  else if (!isdir && typeindex < 0)
+    r = 0; // not one of ours
+  else if (isdir)
+  {
+    r = makedir(outpath);
+    if (r)
+      printf("failed to create output directory '%s'\n", outpath);
+    else
+      r = walkdir(b, inpath, outpath);
+  }
+  else
+    r = addjob(b, inpath, outpath, size, typeindex);
+
+  free(inpath);
+  free(outpath);
+
+  return r;
+}
+
+static int cmpjobsize (const void *a, const void *b)
+{
+  const batchjob_t *ja = a, *jb = b;
+
+  if (ja->size != jb->size)
+    return ja->size < jb->size ? 1 : -1;
+
+  return strcmp(ja->inpath, jb->inpath);
+}
+
+// settings part of a file's cache key, streamed for files that go through inti_stream_file
+static const char *jobsettings (batch_t *b, batchjob_t *job, int streamed, char *buf, size_t size)
+{
+  const inti_filetype_t *predef = &FileTypes[job->typeindex];
+
+  return cache_conv_settings(buf, size, b->encode, streamed, predef->compressed, predef->headerskip, inti_keygen(predef->password1),
+                             predef->password2 ? inti_keygen(predef->password2) : 0);
+}
+
+static void batch_job (void *ctx, int index)
+{
+  batch_t *b = ctx;
+  batchjob_t *job = &b->jobs[index];
+  const inti_filetype_t *predef = &FileTypes[job->typeindex];
+  uint64_t key1, key2, written;
+  double start, secs;
+  cachekey_t cachekey;
+  char settings[160];
+  int caching;
+
+  caching = 0;
+  if (cache_enabled() && !cache_key_file(&cachekey, job->inpath, jobsettings(b, job, 1, settings, sizeof(settings))))
+  {
+    if (!cache_fetch(&cachekey, job->outpath, &written))
+    {
+      job->cached = 1;
+
+      mutex_lock(&b->printlock);
+      printf("cached %s (%s, %"PRIu64" => %"PRIu64" bytes)\n", job->inpath, predef->shorthand, job->size, written);
+      mutex_unlock(&b->printlock);
+      return;
+    }
+
+    caching = 1;
+  }
+
+  key1 = inti_keygen(predef->password1);
+  key2 = predef->password2 ? inti_keygen(predef->password2) : 0;
+
+  start = wallclock();
+  job->failed = inti_stream_file(job->inpath, job->outpath, b->encode, predef->compressed, predef->headerskip, key1, key2, NULL, &written) != 0;
+  secs = wallclock()-start;
+
+  if (caching && !job->failed)
+    cache_store(&cachekey, job->outpath);
+
+  mutex_lock(&b->printlock);
+  if (job->failed)
+    printf("FAILED %s (%s, %"PRIu64" bytes)\n", job->inpath, predef->shorthand, job->size);
+  else
+    printf("ok     %s (%s, %"PRIu64" => %"PRIu64" bytes, %.2f s)\n", job->inpath, predef->shorthand, job->size, written, secs);
+  mutex_unlock(&b->printlock);
+}
+
+// converts one small file in memory, on the pool. the filetypes batch picks
+// never need a steamid
+static void small_job (void *ctx, int index)
+{
+  batch_t *b = ctx;
+  smallfile_t *f = &b->wave[index];
+  inti_cspan_t in;
+  inti_span_t out;
+  double start;
+  int r, level;
+
+  if (f->job->failed || f->job->cached)
+    return;
+
+  // like the streamed path, batches deflate at level 9 when asked to search, and
+  // each file on this pool thread only
+  level = zback_level();
+  if (level == ZBACK_LEVEL_SEARCH)
+    level = 9;
+
+  start = wallclock();
+
+  in.ptr = f->in;
+  in.len = (size_t)f->job->size;
+  out.ptr = NULL;
+
+  if (b->encode)
+    r = inti_encoded_bound(f->job->typeindex, in.len, &out.len);
+  else
+    r = inti_decoded_size(f->job->typeindex, 0, in, &out.len);
+
+  if (r == INTI_OK)
+  {
+    out.ptr = malloc(out.len ? out.len : 1);
+    if (!out.ptr)
+      r = INTI_ERR_MEMORY;
+    else if (b->encode)
+      r = inti_encode_level(f->job->typeindex, 0, in, out, &f->outlen, level, 1);
+    else
+      r = inti_decode(f->job->typeindex, 0, in, out, &f->outlen);
+  }
+
+  free(f->in);
+  f->in = NULL;
+
+  if (r != INTI_OK)
+  {
+    free(out.ptr);
+    f->job->failed = 1;
+
+    mutex_lock(&b->printlock);
+    printf("FAILED %s (%s, %"PRIu64" bytes, %s)\n", f->job->inpath, FileTypes[f->job->typeindex].shorthand, f->job->size, inti_strerror(r));
+    mutex_unlock(&b->printlock);
+    return;
+  }
+
+  f->out = out.ptr;
+  f->secs = wallclock()-start;
+}
+
+static void small_failed (smallfile_t *f)
+{
+  if (!f->job->failed)
+    printf("FAILED %s (%s, %"PRIu64" bytes)\n", f->job->inpath, FileTypes[f->job->typeindex].shorthand, f->job->size);
+
+  f->job->failed = 1;
+}
+
+// takes one completed read or write off the queue
+static int small_reap (batch_t *b, aio_t *aio)
+{
+  smallfile_t *f;
+  int64_t result;
+  void *tag;
+
+  if (aio_wait(aio, &tag, &result))
+    return -1;
+
+  f = tag;
+  aio_close(f->fd);
+  f->fd = -1;
+
+  if (f->state == SMALL_READING)
+  {
+    // a file that changed size since the walk isn't converted half
+    if (result != (int64_t)f->job->size)
+    {
+      small_failed(f);
+      free(f->in);
+      f->in = NULL;
+    }
+    else if (cache_enabled())
+    {
+      char settings[160];
+      uint64_t size;
+
+      cache_key_buffer(&f->cachekey, f->in, (size_t)f->job->size, jobsettings(b, f->job, 0, settings, sizeof(settings)));
+
+      f->caching = 1;
+      if (!cache_fetch(&f->cachekey, f->job->outpath, &size))
+      {
+        f->job->cached = 1;
+        free(f->in);
+        f->in = NULL;
+
+        printf("cached %s (%s, %"PRIu64" => %"PRIu64" bytes)\n", f->job->inpath, FileTypes[f->job->typeindex].shorthand, f->job->size, size);
+      }
+    }
+
+    f->state = SMALL_READ;
+    return 0;
+  }
+
+  free(f->out);
+  f->out = NULL;
+  f->state = SMALL_DONE;
+
+  if (result == (int64_t)f->outlen && f->caching)
+    cache_store(&f->cachekey, f->job->outpath);
+
+  if (result != (int64_t)f->outlen)
+  {
+    small_failed(f);
+    remove(f->job->outpath);
+  }
+  else
+    printf("ok     %s (%s, %"PRIu64" => %"PRIu64" bytes, %.2f s)\n", f->job->inpath, FileTypes[f->job->typeindex].shorthand,
+           f->job->size, (uint64_t)f->outlen, f->secs);
+
+  return 0;
+}
+
+static void small_submit (batch_t *b, aio_t *aio, smallfile_t *f, int write)
+{
+  int r;
+
+  // the queue is full, make room
+  for (;;)
+  {
+    if (write)
+      r = aio_write(aio, f->fd, f->out, f->outlen, 0, f);
+    else
+      r = aio_read(aio, f->fd, f->in, (size_t)f->job->size, 0, f);
+
+    if (!r || small_reap(b, aio))
+      break;
+  }
+}
+
+static void small_reads (batch_t *b, aio_t *aio, smallfile_t *files, int count)
+{
+  smallfile_t *f;
+  int i;
+
+  for (i=0; i<count; i++)
+  {
+    f = &files[i];
+    f->state = SMALL_READ;
+    f->fd = -1;
+    f->in = malloc(f->job->size ? (size_t)f->job->size : 1);
+    f->out = NULL;
+
+    if (f->in)
+      f->fd = aio_open_read(f->job->inpath);
+
+    if (f->fd < 0)
+    {
+      small_failed(f);
+      free(f->in);
+      f->in = NULL;
+      continue;
+    }
+
+    f->state = SMALL_READING;
+    small_submit(b, aio, f, 0);
+  }
+
+  // in flight while the current wave is converted
+  aio_submit(aio);
+}
+
+static void small_writes (batch_t *b, aio_t *aio, smallfile_t *files, int count)
+{
+  smallfile_t *f;
+  int i;
+
+  for (i=0; i<count; i++)
+  {
+    f = &files[i];
+    f->state = SMALL_DONE;
+    if (f->job->failed || f->job->cached)
+      continue;
+
+    f->fd = aio_open_write(f->job->outpath);
+    if (f->fd < 0)
+    {
+      small_failed(f);
+      free(f->out);
+      f->out = NULL;
+      continue;
+    }
+
+    f->state = SMALL_WRITING;
+    small_submit(b, aio, f, 1);
+  }
+
+  aio_submit(aio);
+}
+
+// how many files from files[0] make up the next wave
+static int small_wave (smallfile_t *files, int count)
+{
+  uint64_t bytes;
+  int n;
+
+  bytes = 0;
+  for (n=0; n<count && n<BATCH_WAVEFILES; n++)
+  {
+    if (n && bytes + files[n].job->size > BATCH_WAVEBYTES)
+      break;
+
+    bytes += files[n].job->size;
+  }
+
+  return n;
+}
+
+static const char *small_batch (batch_t *b, batchjob_t *jobs, int count, int numthreads)
+{
+  static char name[16];
+  smallfile_t *files;
+  aio_t *aio;
+  int i, pos, len, nextlen;
+
+  files = calloc(count, sizeof(smallfile_t));
+  aio = aio_create(2*BATCH_WAVEFILES);
+  if (!files || !aio)
+  {
+    for (i=0; i<count; i++)
+    {
+      jobs[i].failed = 1;
+      printf("FAILED %s (out of memory)\n", jobs[i].inpath);
+    }
+
+    free(files);
+    if (aio)
+      aio_destroy(aio);
+    return NULL;
+  }
+
+  inti_lib_init();
+
+  for (i=0; i<count; i++)
+    files[i].job = &jobs[i];
+
+  len = small_wave(files, count);
+  small_reads(b, aio, files, len);
+
+  for (pos=0; pos<count; pos+=len, len=nextlen)
+  {
+    // start reading the next wave before this one is converted
+    nextlen = small_wave(files+pos+len, count-pos-len);
+    small_reads(b, aio, files+pos+len, nextlen);
+
+    for (i=pos; i<pos+len; i++)
+    {
+      while (files[i].state == SMALL_READING)
+      {
+        if (small_reap(b, aio))
+          break;
+      }
+    }
+
+    b->wave = files+pos;
+    pool_run(numthreads, len, small_job, b);
+
+    small_writes(b, aio, files+pos, len);
+  }
+
+  while (aio_inflight(aio))
+  {
+    if (small_reap(b, aio))
+      break;
+  }
+
+  snprintf(name, sizeof(name), "%s", aio_name(aio));
+
+  aio_destroy(aio);
+  free(files);
+
+  return name;
+}
+
+int inti_batch (const char *indir, const char *outdir, int encode, int numthreads)
+{
+  batch_t b;
+  const char *aioname;
+  double start;
+  int i, failed, cached, numlarge;
+
+  memset(&b, 0, sizeof(b));
+  b.encode = encode;
+
+  if (makedir(outdir) || walkdir(&b, indir, outdir))
+  {
+    printf("failed to read input tree '%s' or create output tree '%s'\n", indir, outdir);
+    failed = -1;
+  }
+  else
+  {
+    qsort(b.jobs, b.numjobs, sizeof(batchjob_t), cmpjobsize);
+
+    // the small files are all at the end
+    for (numlarge=0; numlarge<b.numjobs && b.jobs[numlarge].size > BATCH_SMALLFILE; numlarge++);
+
+    start = wallclock();
+
+    mutex_init(&b.printlock);
+    pool_run(numthreads, numlarge, batch_job, &b);
+    aioname = (numlarge < b.numjobs) ? small_batch(&b, b.jobs+numlarge, b.numjobs-numlarge, numthreads) : NULL;
+    mutex_destroy(&b.printlock);
+
+    failed = cached = 0;
+    for (i=0; i<b.numjobs; i++)
+    {
+      failed += b.jobs[i].failed;
+      cached += b.jobs[i].cached;
+    }
+
+    printf("%s %i files in %.2f s, %i failed", encode ? "encoded" : "decoded", b.numjobs, wallclock()-start, failed);
+    if (cache_enabled())
+      printf(", %i from cache", cached);
+    if (aioname)
+      printf(" (%i small files through %s)", b.numjobs-numlarge, aioname);
+    printf("\n");
+  }
+
+  for (i=0; i<b.numjobs; i++)
+  {
+    free(b.jobs[i].inpath);
+    free(b.jobs[i].outpath);
+  }
+  free(b.jobs);
+
+  return failed;
+}
@@ -0,0 +1,13 @@
+//
+// batch conversion of whole directory trees, header
+//
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+// converts every file under indir whose extension maps to a filetype into the
+// same relative path under outdir, numthreads <= 0 means one per cpu
+// returns the number of files that failed, -1 if the tree couldn't be read
+extern int inti_batch (const char *indir, const char *outdir, int encode, int numthreads);
+
+#endif // __BATCH_H__
@@ -0,0 +1,449 @@
+//
+// password discovery for filetypes whose password isn't known yet
+//
+// candidates come from a template (see crack.h) whose tokens are counted like
+// the digits of a mixed-radix number, last token fastest. the number range is
+// cut into pool jobs, and every candidate runs inti_keygen() and descrambles
+// the first 8 bytes: only if those look like a zlib stream header behind the
+// 4 byte length or like text does it get the full (slow) scoring, which
+// descrambles a few KB and tries to inflate or read them
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "encdec.h"
+#include "filetypes.h"
+#include "threads.h"
+#include "pool.h"
+#include "crack.h"
+
+#define MINJOBSIZE (1 << 16) // candidates per pool job, more if there'd be over MAXJOBS jobs
+#define MAXJOBS (1 << 20)
+#define QUICKBYTES 8
+#define MINSCORE 50 // hits below this are not kept
+
+typedef struct
+{
+  const char *set; // characters to pick from, NULL for words and literals
+  int size;
+  int isword;
+  char literal;
+}
+token_t;
+
+typedef struct
+{
+  const uint8_t *data; // scrambled data, or inflated data for files scrambled before compression
+  size_t len;
+  int inflated;
+
+  token_t tokens[CRACK_MAXTOKENS];
+  int numtokens;
+  char **words;
+  uint64_t total, jobsize;
+
+  crack_hit_t hits[CRACK_MAXHITS];
+  int numhits;
+  uint64_t tried;
+  double start, lastprint;
+  mutex_t lock;
+}
+crack_t;
+
+static const char digits[] = "0123456789";
+static const char hexchars[] = "0123456789abcdef";
+static const char lower[] = "abcdefghijklmnopqrstuvwxyz";
+static const char upper[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const char alnum[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+static int parse_template (crack_t *c, const char *pattern, int numwords)
+{
+  token_t *t;
+
+  c->numtokens = 0;
+  c->total = 1;
+
+  while (*pattern)
+  {
+    if (c->numtokens == CRACK_MAXTOKENS)
+    {
+      printf("template has more than %i tokens\n", CRACK_MAXTOKENS);
+      return -1;
+    }
+
+    t = &c->tokens[c->numtokens++];
+    t->set = NULL;
+    t->size = 1;
+    t->isword = 0;
+    t->literal = *pattern;
+
+    if (*pattern++ != '?')
+      continue;
+
+    switch (*pattern++)
+    {
+      case 'w': t->size = numwords; t->isword = 1; break;
+      case 'd': t->set = digits; break;
+      case 'h': t->set = hexchars; break;
+      case 'l': t->set = lower; break;
+      case 'u': t->set = upper; break;
+      case 'a': t->set = alnum; break;
+      case '?': break;
+
+      default:
+        printf("bad template token '?%c'\n", pattern[-1] ? pattern[-1] : ' ');
+        return -1;
+    }
+
+    if (t->set)
+      t->size = strlen(t->set);
+
+    if (t->isword && !numwords)
+    {
+      printf("template uses ?w, but there is no wordlist\n");
+      return -1;
+    }
+
+    if (c->total > ((uint64_t)1 << 56) / t->size)
+    {
+      printf("template generates too many candidates\n");
+      return -1;
+    }
+
+    c->total *= t->size;
+  }
+
+  return 0;
+}
+
+// returns the length, -1 if the candidate is too long
+static int build_candidate (const crack_t *c, const int *pick, char *buf)
+{
+  const token_t *t;
+  int i, n, l;
+
+  n = 0;
+  for (i=0; i<c->numtokens; i++)
+  {
+    t = &c->tokens[i];
+
+    if (t->set)
+    {
+      buf[n++] = t->set[pick[i]];
+    }
+    else if (t->isword)
+    {
+      l = strlen(c->words[pick[i]]);
+      if (n + l >= CRACK_MAXLEN)
+        return -1;
+
+      memcpy(buf+n, c->words[pick[i]], l);
+      n += l;
+    }
+    else
+      buf[n++] = t->literal;
+
+    if (n >= CRACK_MAXLEN)
+      return -1;
+  }
+
+  buf[n] = 0;
+  return n;
+}
+
+static int is_text (uint8_t b)
+{
+  return (b >= 0x20 && b < 0x7F) || b == '\t' || b == '\n' || b == '\r';
+}
+
+static int quick_check (const crack_t *c, uint64_t key)
+{
+  uint8_t b[QUICKBYTES];
+  size_t n, j;
+  int text;
+
+  n = (c->len < QUICKBYTES) ? c->len : QUICKBYTES;
+  text = 1;
+
+  for (j=0; j<n; j++)
+  {
+    b[j] = c->data[j] ^ (key >> (j&0x1F));
+    key = (key + c->data[j])*INTI_CONST1;
+
+    text &= is_text(b[j]);
+  }
+
+  return text || (!c->inflated && n >= 6 && ZlibHeader(b[4], b[5]));
+}
+
+//
+// score out of 100:
+//   zlib: valid header 40, plausible length 10, sample inflates 50
+//   text: up to 70 as the share of text bytes goes from 90 to 100%, 20 for a leading { or [
+//         (JSON), 10 for quotes. keys that only get the low bits right decode text in places,
+//         which is why anything much below all text scores nothing
+//
+static int score (const crack_t *c, uint64_t key)
+{
+  uint8_t sample[CRACK_SAMPLE], out[CRACK_SAMPLE];
+  uint32_t unzsize;
+  z_stream zs;
+  size_t n, i, text, quotes;
+  int s, r;
+
+  n = (c->len < CRACK_SAMPLE) ? c->len : CRACK_SAMPLE;
+  memcpy(sample, c->data, n);
+  inti_dec_from(sample, n, key, 0);
+
+  if (!c->inflated && n >= 6 && ZlibHeader(sample[4], sample[5]))
+  {
+    s = 40;
+
+    memcpy(&unzsize, sample, sizeof(uint32_t));
+    if (unzsize >= c->len/2 && unzsize/1032 <= c->len)
+      s += 10;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) == Z_OK)
+    {
+      zs.next_in = sample+4;
+      zs.avail_in = n-4;
+      zs.next_out = out;
+      zs.avail_out = sizeof(out);
+
+      r = inflate(&zs, Z_SYNC_FLUSH);
+      if ((r == Z_OK || r == Z_STREAM_END || r == Z_BUF_ERROR) && zs.total_out > 0)
+        s += 50;
+
+      inflateEnd(&zs);
+    }
+
+    return s;
+  }
+
+  text = quotes = 0;
+  for (i=0; i<n; i++)
+  {
+    text += is_text(sample[i]);
+    quotes += sample[i] == '"';
+  }
+
+  s = (text*10 >= n*9) ? (int)((text*10 - n*9)*70/n) : 0;
+
+  for (i=0; i<n && (sample[i] == ' ' || sample[i] == '\t' || sample[i] == '\r' || sample[i] == '\n'); i++)
+    ;
+  if (i<n && (sample[i] == '{' || sample[i] == '['))
+    s += 20;
+
+  if (quotes >= 2)
+    s += 10;
+
+  return s;
+}
+
+static void addhit (crack_t *c, const char *password, int s)
+{
+  int i, worst;
+
+  mutex_lock(&c->lock);
+
+  for (i=0; i<c->numhits; i++)
+  {
+    if (!strcmp(c->hits[i].password, password))
+    {
+      mutex_unlock(&c->lock);
+      return; // a wordlist with duplicates
+    }
+  }
+
+  if (c->numhits < CRACK_MAXHITS)
+    worst = c->numhits++;
+  else
+  {
+    worst = 0;
+    for (i=1; i<c->numhits; i++)
+    {
+      if (c->hits[i].score < c->hits[worst].score)
+        worst = i;
+    }
+
+    if (c->hits[worst].score >= s)
+    {
+      mutex_unlock(&c->lock);
+      return;
+    }
+  }
+
+  strcpy(c->hits[worst].password, password);
+  c->hits[worst].score = s;
+
+  mutex_unlock(&c->lock);
+}
+
+static void crack_job (void *ctx, int job)
+{
+  crack_t *c = ctx;
+  int pick[CRACK_MAXTOKENS];
+  char candidate[CRACK_MAXLEN];
+  uint64_t index, end, rest, key;
+  double now;
+  int i, s;
+
+  index = (uint64_t)job*c->jobsize;
+  end = (index + c->jobsize < c->total) ? index + c->jobsize : c->total;
+
+  rest = index;
+  for (i=c->numtokens-1; i>=0; i--)
+  {
+    pick[i] = rest % c->tokens[i].size;
+    rest /= c->tokens[i].size;
+  }
+
+  for (; index<end; index++)
+  {
+    if (build_candidate(c, pick, candidate) >= 0)
+    {
+      key = inti_keygen(candidate);
+
+      if (quick_check(c, key) && (s = score(c, key)) >= MINSCORE)
+        addhit(c, candidate, s);
+    }
+
+    // next candidate, last token fastest
+    for (i=c->numtokens-1; i>=0; i--)
+    {
+      if (++pick[i] < c->tokens[i].size)
+        break;
+      pick[i] = 0;
+    }
+  }
+
+  mutex_lock(&c->lock);
+
+  c->tried += end - (uint64_t)job*c->jobsize;
+
+  now = wallclock();
+  if (now - c->lastprint >= 1.0)
+  {
+    c->lastprint = now;
+    printf("%llu of %llu candidates, %.2f M/s   \r", (unsigned long long)c->tried, (unsigned long long)c->total,
+           c->tried/(now - c->start)/1e6);
+    fflush(stdout);
+  }
+
+  mutex_unlock(&c->lock);
+}
+
+// files that were scrambled before compression start with the length and a plain zlib stream
+static uint8_t *inflate_reverse (const uint8_t *data, size_t len, size_t *outlen)
+{
+  uint32_t unzsize;
+  uint8_t *out;
+  uLongf ulen;
+
+  if (len < 6 || !ZlibHeader(data[4], data[5]))
+    return NULL;
+
+  memcpy(&unzsize, data, sizeof(uint32_t));
+  out = malloc(unzsize ? unzsize : 1);
+  if (!out)
+    return NULL;
+
+  ulen = unzsize;
+  if (uncompress(out, &ulen, data+4, len-4) != Z_OK || ulen != unzsize)
+  {
+    free(out);
+    return NULL;
+  }
+
+  *outlen = ulen;
+  return out;
+}
+
+static int cmphits (const void *a, const void *b)
+{
+  const crack_hit_t *ha = a, *hb = b;
+
+  if (ha->score != hb->score)
+    return ha->score < hb->score ? 1 : -1;
+
+  return strcmp(ha->password, hb->password);
+}
+
+int inti_crack (const uint8_t *scrambled, size_t len, const char *pattern, char **words, int numwords,
+                int numthreads, crack_hit_t *hits, crack_stats_t *stats)
+{
+  crack_t *c;
+  uint8_t *inflated;
+  size_t inflatedlen;
+  uint64_t numjobs;
+  int numhits;
+
+  c = calloc(1, sizeof(crack_t));
+  if (!c)
+  {
+    printf("failed to allocate memory for the search\n");
+    return -1;
+  }
+
+  if (parse_template(c, pattern, numwords))
+  {
+    free(c);
+    return -1;
+  }
+
+  c->jobsize = MINJOBSIZE;
+  while (c->total / c->jobsize >= MAXJOBS)
+    c->jobsize *= 2;
+  numjobs = (c->total + c->jobsize-1) / c->jobsize;
+
+  inflated = inflate_reverse(scrambled, len, &inflatedlen);
+  if (inflated)
+  {
+    printf("input is a zlib stream, searching the password of its contents\n");
+    c->data = inflated;
+    c->len = inflatedlen;
+    c->inflated = 1;
+  }
+  else
+  {
+    c->data = scrambled;
+    c->len = len;
+  }
+
+  if (!c->len)
+  {
+    printf("nothing to search with (empty input)\n");
+    free(inflated);
+    free(c);
+    return -1;
+  }
+
+  c->words = words;
+  c->start = c->lastprint = wallclock();
+
+  mutex_init(&c->lock);
+  pool_run(numthreads, (int)numjobs, crack_job, c);
+  mutex_destroy(&c->lock);
+
+  qsort(c->hits, c->numhits, sizeof(crack_hit_t), cmphits);
+  memcpy(hits, c->hits, sizeof(crack_hit_t)*c->numhits);
+  numhits = c->numhits;
+
+  if (stats)
+  {
+    stats->total = c->total;
+    stats->tried = c->tried;
+    stats->seconds = wallclock() - c->start;
+  }
+
+  free(inflated);
+  free(c);
+
+  return numhits;
+}
@@ -0,0 +1,42 @@
+//
+// password discovery for filetypes whose password isn't known yet, header
+//
+
+#ifndef __CRACK_H__
+#define __CRACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRACK_MAXLEN 64     // longest password a template may produce
+#define CRACK_MAXTOKENS 32
+#define CRACK_MAXHITS 32
+#define CRACK_SAMPLE 4096   // decoded bytes that are scored for candidates passing the quick check
+
+// template tokens, everything else is a literal character:
+//   ?w  a word from the wordlist    ?d  0-9      ?h  0-9a-f
+//   ?l  a-z     ?u  A-Z             ?a  a-zA-Z0-9    ??  a '?'
+// e.g. "?w90210", "txt20?d?d?d?d?d?d", "?a?a?a?a?a?a?a?a"
+
+typedef struct
+{
+  char password[CRACK_MAXLEN];
+  int score; // 0..100, see crack.c
+}
+crack_hit_t;
+
+typedef struct
+{
+  uint64_t total;   // candidates the template generates
+  uint64_t tried;
+  double seconds;
+}
+crack_stats_t;
+
+// scrambled is the file as it is on disk. files that start with a length and a
+// plain zlib header (scrambled before compression, like json2) are inflated first.
+// returns the number of hits stored in hits (best first), -1 on failure
+extern int inti_crack (const uint8_t *scrambled, size_t len, const char *pattern, char **words, int numwords,
+                       int numthreads, crack_hit_t *hits, crack_stats_t *stats);
+
+#endif // __CRACK_H__
@@ -19,24 +19,169 @@ uint64_t inti_keygen (const char *password)
   return key;
 }
 
-void inti_encdec (uint8_t *buffer, int mode, int len, uint64_t key)
+void inti_encdec (uint8_t *buffer, int mode, size_t len, uint64_t key)
 {
-  int i;
-  uint64_t blockkey;
-  uint8_t tmp;
+  if (mode == ENCDEC_MODE_DEC)
+    inti_dec_from(buffer, len, key, 0);
+  else
+    inti_enc_from(buffer, len, key, 0);
+}
+
+#define DEC2_WINDOW (16*1024) // stays in L1 between the two decode passes
+
+void inti_encdec2 (uint8_t *buffer, int mode, size_t len, uint64_t key1, uint64_t key2)
+{
+  inti_encdec2_from(buffer, mode, len, &key1, &key2, 0);
+}
+
+void inti_encdec2_from (uint8_t *buffer, int mode, size_t len, uint64_t *key1, uint64_t *key2, size_t pos)
+{
+  size_t i, n;
+  uint64_t k1, k2;
+  uint8_t tmp, mid;
+
+  k1 = *key1;
+  k2 = *key2;
 
-  blockkey = key;
+  if (mode == ENCDEC_MODE_DEC)
+  {
+    // both key chains only depend on bytes that are already known,
+    // so just run the vector kernel twice over each cached window
+    for (i=0; i<len; i+=n)
+    {
+      n = (len-i < DEC2_WINDOW) ? len-i : DEC2_WINDOW;
+
+      k1 = inti_dec_from(buffer+i, n, k1, pos+i);
+      k2 = inti_dec_from(buffer+i, n, k2, pos+i);
+    }
+  }
+  else
+  {
+    // encoding: key1 takes the intermediate byte, key2 the final one,
+    // the two multiplies are independent and overlap
+    for (i=0; i<len; i++)
+    {
+      tmp = buffer[i];
+
+      mid = tmp ^ ((k1>>((pos+i)&0x1F))&0xFF);
+      buffer[i] = mid ^ ((k2>>((pos+i)&0x1F))&0xFF);
+
+      k1 += mid;
+      k2 += buffer[i];
+
+      k1 *= INTI_CONST1;
+      k2 *= INTI_CONST1;
+    }
+  }
+
+  *key1 = k1;
+  *key2 = k2;
+}
+
+uint64_t inti_enc_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos)
+{
+  size_t i;
 
   for (i=0; i<len; i++)
   {
-    tmp = buffer[i];
-    buffer[i] = tmp ^ ((blockkey>>(i&0x1F))&0xFF);
+    buffer[i] ^= (blockkey>>((pos+i)&0x1F))&0xFF;
+
+    blockkey += buffer[i];
+    blockkey *= INTI_CONST1;
+  }
+
+  return blockkey;
+}
+
+void inti_state_init (inti_state_t *st, int mode, uint64_t key1, uint64_t key2)
+{
+  st->mode = mode;
+  st->key1 = key1;
+  st->key2 = key2;
+  st->pos = 0;
+}
+
+void inti_state_update (inti_state_t *st, uint8_t *buffer, size_t len)
+{
+  if (st->key2)
+    inti_encdec2_from(buffer, st->mode, len, &st->key1, &st->key2, st->pos);
+  else if (st->mode == ENCDEC_MODE_DEC)
+    st->key1 = inti_dec_from(buffer, len, st->key1, st->pos);
+  else
+    st->key1 = inti_enc_from(buffer, len, st->key1, st->pos);
+
+  st->pos += len;
+}
+
+uint64_t inti_pow (size_t n)
+{
+  uint64_t result, base;
 
-    if (mode == ENCDEC_MODE_ENC)
-      blockkey += buffer[i];
-    else
-      blockkey += tmp;
+  result = 1;
+  base = INTI_CONST1;
+
+  while (n)
+  {
+    if (n & 1)
+      result *= base;
+
+    base *= base;
+    n >>= 1;
+  }
+
+  return result;
+}
 
+uint64_t inti_dec_scan (const uint8_t *buffer, size_t len)
+{
+  size_t i;
+  uint64_t sum;
+
+  sum = 0;
+
+  for (i=0; i<len; i++)
+  {
+    sum += buffer[i];
+    sum *= INTI_CONST1;
+  }
+
+  return sum;
+}
+
+uint64_t inti_dec_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos)
+{
+  size_t head, numblocks;
+
+  // bytes up to the next 32 byte boundary, then whole blocks, then the rest
+  head = (32 - (pos & 0x1F)) & 0x1F;
+  if (head > len)
+    head = len;
+
+  blockkey = inti_dec_scalar(buffer, head, blockkey, pos);
+  buffer += head;
+  pos += head;
+  len -= head;
+
+  numblocks = len / 32;
+  if (numblocks)
+    blockkey = inti_dec_blocks(buffer, numblocks, blockkey);
+
+  return inti_dec_scalar(buffer+numblocks*32, len-numblocks*32, blockkey, pos+numblocks*32);
+}
+
+uint64_t inti_dec_scalar (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos)
+{
+  size_t i;
+  uint8_t tmp;
+
+  for (i=0; i<len; i++)
+  {
+    tmp = buffer[i];
+    buffer[i] = tmp ^ ((blockkey>>((pos+i)&0x1F))&0xFF);
+
+    blockkey += tmp;
     blockkey *= INTI_CONST1;
   }
+
+  return blockkey;
 }
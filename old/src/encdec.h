@@ -2,6 +2,7 @@
 #define __ENCDEC_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define INTI_BASEKEY 0xA1B34F58CAD705B2ULL
 #define INTI_CONST1 141
@@ -11,7 +12,41 @@ enum {
   ENCDEC_MODE_DEC
 };
 
+enum {
+  INTI_SIMD_NONE,
+  INTI_SIMD_AVX2
+};
+
+// running state for scrambling a stream piece by piece
+typedef struct
+{
+  int mode;
+  uint64_t key1;
+  uint64_t key2; // 0 if the filetype only has one password
+  size_t pos;
+}
+inti_state_t;
+
 extern uint64_t inti_keygen (const char *password);
-extern void inti_encdec (uint8_t *buffer, int mode, int len, uint64_t key);
+extern void inti_encdec (uint8_t *buffer, int mode, size_t len, uint64_t key);
+extern void inti_encdec2 (uint8_t *buffer, int mode, size_t len, uint64_t key1, uint64_t key2); // same as key1 pass then key2 pass, in one pass over memory
+extern void inti_encdec2_from (uint8_t *buffer, int mode, size_t len, uint64_t *key1, uint64_t *key2, size_t pos); // same, continuing at stream offset pos
+extern uint64_t inti_enc_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos); // scramble continuing at stream offset pos, returns the next blockkey
+
+extern void inti_state_init (inti_state_t *st, int mode, uint64_t key1, uint64_t key2);
+extern void inti_state_update (inti_state_t *st, uint8_t *buffer, size_t len);
+
+// when decoding, blockkey only ever absorbs ciphertext bytes, so the key at
+// stream offset n is key*141^n + (sum of c[j]*141^(n-j)), which lets a buffer
+// be split into chunks that are descrambled independently
+extern uint64_t inti_pow (size_t n); // 141^n (mod 2^64)
+extern uint64_t inti_dec_scan (const uint8_t *buffer, size_t len); // ciphertext term of the above for one chunk
+extern uint64_t inti_dec_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos); // descramble a chunk at stream offset pos, returns the next blockkey
+extern uint64_t inti_dec_scalar (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos); // same, plain byte loop
+
+// simddec.c: whole 32 byte blocks (starting on a multiple of 32), vectorized if the cpu allows
+extern uint64_t inti_dec_blocks (uint8_t *buffer, size_t numblocks, uint64_t blockkey);
+extern void inti_dec_set_simd (int level); // INTI_SIMD_*, -1 or unsupported = best available
+extern int inti_dec_get_simd (void);
 
 #endif // __ENCDEC_H__
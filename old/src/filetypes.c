@@ -0,0 +1,144 @@
+//
+// predefined filetypes
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifndef _MSC_VER
+ #include <strings.h>
+ #define stricmp strcasecmp
+#endif
+
+#include "encdec.h"
+#include "filetypes.h"
+
+const inti_filetype_t FileTypes[] =
+{
+  { "bft",    "bft90210",NULL,     COMP_YES,    0, 0, "bfb" }, // BMPFont*.bfb files
+  { "obj",    "obj90210",NULL,     COMP_YES,    0, 0, "osb" }, // *.osb
+  { "scroll", "scroll90210",NULL,  COMP_YES,    0, 0, "scb" }, // stage "scroll" (background) files, *.scb
+  { "set",    "set90210",NULL,     COMP_NO,     0, 0, "stb" }, // stage "set" (setup?) files, *.stb
+  { "snd",    "snd90210",NULL,     COMP_NO,     0, 0, "bisar" }, // *.bisar (some kind of index or keys to sound data .bigrp files?)
+  { "txt",    "txt20170401",NULL,  COMP_YES,    0, 0, "ttb" }, // text resource files, *.ttb
+  { "txt2",   "x4NKvf3U",NULL,     COMP_YES,    0, 0, "tb2" }, // v2 text resource files, *.tb2
+  
+  { "json",   "json180601",NULL,   COMP_YES,     0, 0, NULL }, // haven't found any yet, doesn't work for JSON files from DMFD PC
+  { "json2",  "xN5sUeRo",NULL,     COMP_REVERSE, 0, 0, NULL }, // JSON files from DMFD PC, data is scrambled *before* it is zlib compressed!
+  
+  { "save1", "gYjkJoTX","zZ2c9VTK",  COMP_NO, 16, 0, NULL },  // system and game save data files from COTM1 and COTM2, scrambled twice with two
+  { "save2", "gVTYZ2jk","JoTXzc9K",  COMP_NO, 16, 0, NULL },  // different passwords/keys, also there's a 16-byte header which IS NOT scrambled.
+  
+  { "save3", "gYjkJoTX","zZ2c9VTK",  COMP_NO, 16, 1, NULL },  // DMFD PC save data, same deal, two passwords, untouched header, but the passwords
+													     // have a tail appended that is based on the player's Steam ID (least significant
+													     // 32 bits of it in hex)
+  
+  { "ssbpi",  "ssbpi90210",NULL,     COMP_NO, 0, 0, NULL }, // ??? may be compressed as well, or may not even exist anywhere!
+
+   { NULL, NULL, NULL, 0, 0, 0, NULL }
+};
+
+int CountFileTypes (void)
+{
+  int i;
+
+  i = 0;
+  while (FileTypes[i].shorthand != NULL) i++;
+
+  return i;
+}
+
+int FindFileTypeByExtension (const char *path)
+{
+  const char *ext;
+  int i, count;
+
+  ext = strrchr(path, '.');
+  if (!ext || strchr(ext, '/') || strchr(ext, '\\'))
+    return -1;
+
+  count = CountFileTypes();
+  for (i=0; i<count; i++)
+  {
+    if (FileTypes[i].extension && !stricmp(FileTypes[i].extension, ext+1))
+      return i;
+  }
+
+  return -1;
+}
+
+// deflate with any window size (-l search also writes 8K and 16K ones), no
+// preset dictionary, and the check bits right
+int ZlibHeader (uint8_t cmf, uint8_t flg)
+{
+  return (cmf & 0x0F) == 8 && (cmf >> 4) <= 7 && !(flg & 0x20) && ((cmf << 8) | flg) % 31 == 0;
+}
+
+//
+// compressed filetypes start with the uncompressed size and a zlib header, so
+// descrambling the first few bytes with each password tells them apart: the
+// header has to be valid, the size has to fit the file size, and the bytes
+// after the header have to start inflating. uncompressed and steamid types
+// can't be told from noise that way and are never detected
+//
+static int plausible (const uint8_t *b, size_t len, uint64_t filesize)
+{
+  uint8_t out[256];
+  uint32_t unzsize;
+  uint64_t datasize;
+  z_stream zs;
+  int r;
+
+  if (len < 6 || filesize < 6)
+    return 0;
+
+  if (!ZlibHeader(b[4], b[5]))
+    return 0;
+
+  // deflate can't do better than about 1:1032, nor worse than stored blocks
+  memcpy(&unzsize, b, sizeof(uint32_t));
+  datasize = filesize-4;
+  if ((uint64_t)unzsize*1032 < datasize || datasize > (uint64_t)unzsize + unzsize/1000 + 64)
+    return 0;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK)
+    return 0;
+
+  zs.next_in = (uint8_t *)b+4;
+  zs.avail_in = len-4;
+  zs.next_out = out;
+  zs.avail_out = sizeof(out);
+
+  r = inflate(&zs, Z_SYNC_FLUSH);
+  inflateEnd(&zs);
+
+  return r == Z_OK || r == Z_STREAM_END || r == Z_BUF_ERROR;
+}
+
+int DetectFileType (const uint8_t *head, size_t len, uint64_t filesize)
+{
+  uint8_t b[FILETYPE_DETECT_BYTES];
+  int i, count;
+
+  if (len > FILETYPE_DETECT_BYTES)
+    len = FILETYPE_DETECT_BYTES;
+
+  count = CountFileTypes();
+  for (i=0; i<count; i++)
+  {
+    if (FileTypes[i].compressed == COMP_NO || FileTypes[i].need_steamid)
+      continue;
+
+    memcpy(b, head, len);
+    if (FileTypes[i].compressed == COMP_YES)
+      inti_encdec(b, ENCDEC_MODE_DEC, len, inti_keygen(FileTypes[i].password1));
+
+    if (plausible(b, len, filesize))
+      return i;
+  }
+
+  return -1;
+}
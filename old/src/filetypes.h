@@ -0,0 +1,39 @@
+//
+// predefined filetypes, header
+//
+
+#ifndef __FILETYPES_H__
+#define __FILETYPES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILETYPE_DETECT_BYTES 16 // bytes from the start of a file that DetectFileType looks at
+
+enum
+{
+  COMP_NO,
+  COMP_YES,
+  COMP_REVERSE
+};
+
+typedef struct
+{
+  const char *shorthand;
+  const char *password1;
+  const char *password2;
+  const int compressed;
+  const int headerskip;
+  const int need_steamid;
+  const char *extension; // used to pick the filetype in batch mode, NULL if ambiguous
+}
+inti_filetype_t;
+
+extern const inti_filetype_t FileTypes[];
+
+extern int CountFileTypes (void);
+extern int FindFileTypeByExtension (const char *path); // index into FileTypes, -1 if unknown
+extern int DetectFileType (const uint8_t *head, size_t len, uint64_t filesize); // same, from the first bytes of a scrambled file
+extern int ZlibHeader (uint8_t cmf, uint8_t flg); // nonzero if the two bytes start a zlib stream
+
+#endif // __FILETYPES_H__
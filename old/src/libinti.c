@@ -0,0 +1,355 @@
+//
+// library interface for embedding the converter
+//
+// the same conversions as the d/e commands, but between caller provided buffers.
+// compressed input is descrambled through a small scratch window on the stack
+// straight into inflate, and compressed output is written straight into the
+// caller's buffer and scrambled there, so apart from scrambling before
+// compression (json2) no copy of the data is ever made
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifndef _MSC_VER
+ #include <strings.h>
+ #define stricmp strcasecmp
+#endif
+
+#include "encdec.h"
+#include "filetypes.h"
+#include "zback.h"
+#include "libinti.h"
+
+#define SCRATCHSIZE (16*1024)
+
+static const char *errors[] =
+{
+  "ok",
+  "unknown filetype",
+  "filetype needs a steamid",
+  "output buffer too small",
+  "input too short or bad size header",
+  "zlib data is corrupt",
+  "out of memory"
+};
+
+void inti_lib_init (void)
+{
+  inti_dec_get_simd(); // picks the kernel and fills the tables that are otherwise set up lazily
+}
+
+const char *inti_strerror (int err)
+{
+  if (err > 0 || -err >= (int)(sizeof(errors)/sizeof(errors[0])))
+    return "unknown error";
+
+  return errors[-err];
+}
+
+int inti_lib_filetype (const char *shorthand)
+{
+  int i, count;
+
+  count = CountFileTypes();
+  for (i=0; i<count; i++)
+  {
+    if (!stricmp(FileTypes[i].shorthand, shorthand))
+      return i;
+  }
+
+  return INTI_ERR_FILETYPE;
+}
+
+int inti_lib_detect (inti_cspan_t in)
+{
+  int i;
+
+  i = DetectFileType(in.ptr, in.len, in.len);
+  return (i < 0) ? INTI_ERR_FILETYPE : i;
+}
+
+static int getkeys (int filetype, uint64_t steamid, uint64_t *key1, uint64_t *key2)
+{
+  const inti_filetype_t *predef;
+  char pwdbuf[64];
+
+  if (filetype < 0 || filetype >= CountFileTypes())
+    return INTI_ERR_FILETYPE;
+
+  predef = &FileTypes[filetype];
+  *key2 = 0;
+
+  if (predef->need_steamid)
+  {
+    if (!steamid)
+      return INTI_ERR_STEAMID;
+
+    snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", predef->password1, (uint32_t)steamid);
+    *key1 = inti_keygen(pwdbuf);
+
+    if (predef->password2)
+    {
+      snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", predef->password2, (uint32_t)steamid);
+      *key2 = inti_keygen(pwdbuf);
+    }
+  }
+  else
+  {
+    *key1 = inti_keygen(predef->password1);
+
+    if (predef->password2)
+      *key2 = inti_keygen(predef->password2);
+  }
+
+  return INTI_OK;
+}
+
+static int decoded_size (int compressed, int headerskip, uint64_t key1, uint64_t key2, inti_cspan_t in, size_t *size)
+{
+  uint8_t header[sizeof(uint32_t)];
+  uint32_t unzsize;
+  inti_state_t st;
+
+  if (compressed == COMP_NO)
+  {
+    if (in.len < (size_t)headerskip)
+      return INTI_ERR_FORMAT;
+
+    *size = in.len;
+    return INTI_OK;
+  }
+
+  if (in.len < sizeof(uint32_t))
+    return INTI_ERR_FORMAT;
+
+  memcpy(header, in.ptr, sizeof(uint32_t));
+
+  // the size header of COMP_REVERSE files is not scrambled
+  if (compressed == COMP_YES)
+  {
+    inti_state_init(&st, ENCDEC_MODE_DEC, key1, key2);
+    inti_state_update(&st, header, sizeof(uint32_t));
+  }
+
+  memcpy(&unzsize, header, sizeof(uint32_t));
+  *size = unzsize;
+
+  return INTI_OK;
+}
+
+int inti_decoded_size (int filetype, uint64_t steamid, inti_cspan_t in, size_t *size)
+{
+  uint64_t key1, key2;
+  int r;
+
+  r = getkeys(filetype, steamid, &key1, &key2);
+  if (r)
+    return r;
+
+  return decoded_size(FileTypes[filetype].compressed, FileTypes[filetype].headerskip, key1, key2, in, size);
+}
+
+int inti_encoded_bound (int filetype, size_t inlen, size_t *size)
+{
+  if (filetype < 0 || filetype >= CountFileTypes())
+    return INTI_ERR_FILETYPE;
+
+  if (FileTypes[filetype].compressed == COMP_NO)
+    *size = inlen;
+  else
+    *size = sizeof(uint32_t) + zback_bound(inlen);
+
+  return INTI_OK;
+}
+
+// descrambles in through the scratch window and inflates it into out
+static int decode_compressed (inti_state_t *st, inti_cspan_t in, inti_span_t out, size_t unzsize, size_t *outlen)
+{
+  uint8_t scratch[SCRATCHSIZE], dummy;
+  z_stream zs;
+  size_t pos, n;
+  int r;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK)
+    return INTI_ERR_MEMORY;
+
+  // an empty payload comes with an unmapped (NULL) output, which inflate refuses
+  zs.next_out = out.ptr ? out.ptr : &dummy;
+  zs.avail_out = (uInt)unzsize; // checked against the size header, which is 32-bit
+
+  r = Z_OK;
+  pos = 0;
+  while (r == Z_OK && pos < in.len)
+  {
+    n = (in.len-pos < SCRATCHSIZE) ? in.len-pos : SCRATCHSIZE;
+    memcpy(scratch, in.ptr+pos, n);
+    inti_state_update(st, scratch, n);
+
+    // the first window starts with the size header
+    zs.next_in = scratch + (pos ? 0 : sizeof(uint32_t));
+    zs.avail_in = (uInt)(pos ? n : n - sizeof(uint32_t));
+    pos += n;
+
+    r = inflate(&zs, Z_NO_FLUSH);
+    if (r == Z_BUF_ERROR && zs.avail_out)
+      r = Z_OK; // only out of input, there's more
+  }
+
+  *outlen = zs.total_out;
+  inflateEnd(&zs);
+
+  return (r == Z_STREAM_END) ? INTI_OK : INTI_ERR_ZLIB;
+}
+
+int inti_decode (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen)
+{
+  uint64_t key1, key2;
+  int r;
+
+  *outlen = 0;
+
+  r = getkeys(filetype, steamid, &key1, &key2);
+  if (r)
+    return r;
+
+  return inti_decode_keys(FileTypes[filetype].compressed, FileTypes[filetype].headerskip, key1, key2, in, out, outlen);
+}
+
+int inti_decode_keys (int compressed, int headerskip, uint64_t key1, uint64_t key2, inti_cspan_t in, inti_span_t out, size_t *outlen)
+{
+  inti_state_t st;
+  size_t size;
+  int r;
+
+  *outlen = 0;
+
+  r = decoded_size(compressed, headerskip, key1, key2, in, &size);
+  if (r)
+    return r;
+
+  if (out.len < size)
+  {
+    *outlen = size;
+    return INTI_ERR_SPACE;
+  }
+
+  inti_state_init(&st, ENCDEC_MODE_DEC, key1, key2);
+
+  if (compressed == COMP_NO)
+  {
+    if (out.ptr != in.ptr)
+      memcpy(out.ptr, in.ptr, in.len);
+
+    inti_state_update(&st, out.ptr + headerskip, in.len - headerskip);
+    *outlen = in.len;
+
+    return INTI_OK;
+  }
+
+  if (compressed == COMP_REVERSE)
+  {
+    *outlen = size;
+    if (zback_uncompress(out.ptr, outlen, in.ptr+sizeof(uint32_t), in.len-sizeof(uint32_t)) != Z_OK)
+      return INTI_ERR_ZLIB;
+
+    inti_state_update(&st, out.ptr, *outlen);
+    return INTI_OK;
+  }
+
+  return decode_compressed(&st, in, out, size, outlen);
+}
+
+int inti_encode (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen)
+{
+  return inti_encode_level(filetype, steamid, in, out, outlen, zback_level(), 0);
+}
+
+int inti_encode_level (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen, int level, int numthreads)
+{
+  const inti_filetype_t *predef;
+  uint64_t key1, key2;
+  inti_state_t st;
+  uint32_t unzsize;
+  uint8_t *source;
+  size_t zsize;
+  int r;
+
+  *outlen = 0;
+
+  r = getkeys(filetype, steamid, &key1, &key2);
+  if (r)
+    return r;
+
+  predef = &FileTypes[filetype];
+  inti_state_init(&st, ENCDEC_MODE_ENC, key1, key2);
+
+  if (predef->compressed == COMP_NO)
+  {
+    if (in.len < (size_t)predef->headerskip)
+      return INTI_ERR_FORMAT;
+
+    if (out.len < in.len)
+    {
+      *outlen = in.len;
+      return INTI_ERR_SPACE;
+    }
+
+    if (out.ptr != in.ptr)
+      memcpy(out.ptr, in.ptr, in.len);
+
+    inti_state_update(&st, out.ptr + predef->headerskip, in.len - predef->headerskip);
+    *outlen = in.len;
+
+    return INTI_OK;
+  }
+
+  unzsize = (uint32_t)in.len;
+  if (unzsize != in.len)
+    return INTI_ERR_FORMAT; // doesn't fit the size header
+
+  if (out.len < sizeof(uint32_t))
+  {
+    *outlen = sizeof(uint32_t) + zback_bound(in.len);
+    return INTI_ERR_SPACE;
+  }
+
+  // json2 is scrambled before it is compressed, which needs a copy of the input
+  source = (uint8_t *)in.ptr;
+  if (predef->compressed == COMP_REVERSE)
+  {
+    source = malloc(in.len ? in.len : 1);
+    if (!source)
+      return INTI_ERR_MEMORY;
+
+    memcpy(source, in.ptr, in.len);
+    inti_state_update(&st, source, in.len);
+  }
+
+  zsize = out.len - sizeof(uint32_t);
+  r = zback_compress_threads(out.ptr+sizeof(uint32_t), &zsize, source, in.len, level, numthreads);
+
+  if (source != in.ptr)
+    free(source);
+
+  if (r != Z_OK)
+  {
+    if (r != Z_BUF_ERROR)
+      return (r == Z_MEM_ERROR) ? INTI_ERR_MEMORY : INTI_ERR_ZLIB;
+
+    *outlen = sizeof(uint32_t) + zback_bound(in.len);
+    return INTI_ERR_SPACE;
+  }
+
+  memcpy(out.ptr, &unzsize, sizeof(uint32_t));
+
+  if (predef->compressed == COMP_YES)
+    inti_state_update(&st, out.ptr, sizeof(uint32_t) + zsize);
+
+  *outlen = sizeof(uint32_t) + zsize;
+  return INTI_OK;
+}
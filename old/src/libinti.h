@@ -0,0 +1,85 @@
+//
+// library interface for embedding the converter, header
+//
+// everything works on caller provided buffers and returns INTI_OK or one of the
+// INTI_ERR_* codes, nothing is printed and nothing exits. the functions keep no
+// state between calls, so any number of threads can convert files at the same
+// time once inti_lib_init() has run
+//
+
+#ifndef __LIBINTI_H__
+#define __LIBINTI_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32) && defined(INTI_DLL)
+  #define INTI_API __declspec(dllexport)
+#else
+  #define INTI_API
+#endif
+
+enum
+{
+  INTI_OK = 0,
+  INTI_ERR_FILETYPE = -1,   // unknown filetype, or not detected
+  INTI_ERR_STEAMID = -2,    // the filetype needs a steamid
+  INTI_ERR_SPACE = -3,      // output buffer too small, *outlen says how much is needed if known
+  INTI_ERR_FORMAT = -4,     // input too short, too big or its size header is wrong
+  INTI_ERR_ZLIB = -5,       // compressed data is corrupt (or the filetype is wrong)
+  INTI_ERR_MEMORY = -6
+};
+
+typedef struct
+{
+  const uint8_t *ptr;
+  size_t len;
+}
+inti_cspan_t;
+
+typedef struct
+{
+  uint8_t *ptr;
+  size_t len; // capacity
+}
+inti_span_t;
+
+// sets up the descrambler tables, call once before converting on several threads
+INTI_API void inti_lib_init (void);
+INTI_API const char *inti_strerror (int err);
+
+// filetype by shorthand ("bft", "txt", ...) or from the first bytes of a scrambled
+// file (compressed filetypes only, see DetectFileType), INTI_ERR_FILETYPE if none
+INTI_API int inti_lib_filetype (const char *shorthand);
+INTI_API int inti_lib_detect (inti_cspan_t in);
+
+// exact size of the decoded data (from the size header of compressed filetypes),
+// and an upper bound for the encoded size. steamid is only used by filetypes that
+// need one and may be 0 otherwise
+INTI_API int inti_decoded_size (int filetype, uint64_t steamid, inti_cspan_t in, size_t *size);
+INTI_API int inti_encoded_bound (int filetype, size_t inlen, size_t *size);
+
+// outlen receives the number of bytes written to out. for uncompressed filetypes
+// in and out may be the same memory, which converts in place. encoding uses
+// zback_level()/zback_strategy() and the selected backend, changing those while
+// other threads encode is not safe (nor is -l search, which records its winner)
+INTI_API int inti_decode (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen);
+INTI_API int inti_encode (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen);
+
+// inti_encode with the deflate level (as zback_level() gives) and thread count given
+// directly. numthreads 1 deflates on the calling thread, e.g. from a thread pool job
+INTI_API int inti_encode_level (int filetype, uint64_t steamid, inti_cspan_t in, inti_span_t out, size_t *outlen, int level, int numthreads);
+
+// inti_decode with the keys and format given directly (compressed is one of COMP_*,
+// key2 is 0 for one password), for filetypes that aren't in FileTypes
+INTI_API int inti_decode_keys (int compressed, int headerskip, uint64_t key1, uint64_t key2, inti_cspan_t in, inti_span_t out, size_t *outlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __LIBINTI_H__
@@ -15,62 +15,22 @@
 
 #include "mmfiles.h"
 #include "encdec.h"
+#include "mtdec.h"
+#include "filetypes.h"
+#include "stream.h"
+#include "batch.h"
+#include "threads.h"
+#include "seekidx.h"
+#include "steamid.h"
+#include "crack.h"
+#include "zback.h"
+#include "pzlib.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "libinti.h"
 
 typedef uint8_t byte;
 
-enum
-{
-  COMP_NO,
-  COMP_YES,
-  COMP_REVERSE
-};
-
-typedef struct
-{
-  const char *shorthand;
-  const char *password1;
-  const char *password2;
-  const int compressed;
-  const int headerskip;
-  const int need_steamid;
-}
-inti_filetype_t;
-
-const inti_filetype_t FileTypes[] =
-{
-  { "bft",    "bft90210",NULL,     COMP_YES,    0, 0 }, // BMPFont*.bfb files
-  { "obj",    "obj90210",NULL,     COMP_YES,    0, 0 }, // *.osb
-  { "scroll", "scroll90210",NULL,  COMP_YES,    0, 0 }, // stage "scroll" (background) files, *.scb
-  { "set",    "set90210",NULL,     COMP_NO,     0, 0 }, // stage "set" (setup?) files, *.stb
-  { "snd",    "snd90210",NULL,     COMP_NO,     0, 0 }, // *.bisar (some kind of index or keys to sound data .bigrp files?)
-  { "txt",    "txt20170401",NULL,  COMP_YES,    0, 0 }, // text resource files, *.ttb
-  { "txt2",   "x4NKvf3U",NULL,     COMP_YES,    0, 0 }, // v2 text resource files, *.tb2
-  
-  { "json",   "json180601",NULL,   COMP_YES,     0, 0 }, // haven't found any yet, doesn't work for JSON files from DMFD PC
-  { "json2",  "xN5sUeRo",NULL,     COMP_REVERSE, 0, 0 }, // JSON files from DMFD PC, data is scrambled *before* it is zlib compressed!
-  
-  { "save1", "gYjkJoTX","zZ2c9VTK",  COMP_NO, 16, 0 },  // system and game save data files from COTM1 and COTM2, scrambled twice with two
-  { "save2", "gVTYZ2jk","JoTXzc9K",  COMP_NO, 16, 0 },  // different passwords/keys, also there's a 16-byte header which IS NOT scrambled.
-  
-  { "save3", "gYjkJoTX","zZ2c9VTK",  COMP_NO, 16, 1 },  // DMFD PC save data, same deal, two passwords, untouched header, but the passwords
-													     // have a tail appended that is based on the player's Steam ID (least significant
-													     // 32 bits of it in hex)
-  
-  { "ssbpi",  "ssbpi90210",NULL,     COMP_NO, 0, 0 }, // ??? may be compressed as well, or may not even exist anywhere!
-
-   { NULL, NULL, NULL, 0, 0, 0 }
-};
-
-int CountFileTypes (void)
-{
-  int i;
-
-  i = 0;
-  while (FileTypes[i].shorthand != NULL) i++;
-
-  return i;
-}
-
 void PrintFileTypes (void)
 {
   int i, count;
@@ -99,6 +59,36 @@ int GetIntiFileType (char *search)
   exit(-1);
 }
 
+// for "auto": picks the filetype from the first bytes of the file, or failing that its extension
+int DetectIntiFileType (char *inpath)
+{
+  mmapinfo_t *mminfile;
+  int i;
+
+  mminfile = mmap_existing_read(inpath);
+  if (!mminfile)
+  {
+    printf("failed to memory map input file '%s'\n", inpath);
+    exit(-1);
+  }
+
+  i = DetectFileType(mminfile->ptr, mminfile->size, mminfile->size);
+  close_mmapping(mminfile);
+
+  if (i < 0)
+    i = FindFileTypeByExtension(inpath);
+
+  if (i < 0)
+  {
+    printf("couldn't detect the filetype of '%s', specify it\n", inpath);
+    PrintFileTypes();
+    exit(-1);
+  }
+
+  printf("detected filetype '%s'\n", FileTypes[i].shorthand);
+  return i;
+}
+
 void ShowUsage (void)
 {
   printf("\n"\
@@ -108,6 +98,64 @@ void ShowUsage (void)
 		 "        Save files from certain games may require your SteamID to\n"\
 		 "        descramble/scramble! Input it after the file type if necessary.\n"\
 		 "        The filetypes which require your steamid are marked with a '*'.\n"\
+         "        When decoding, 'auto' picks a compressed filetype from the first\n"\
+         "        bytes of the file (others by extension).\n"\
+         "\n"\
+         "       inti_encdec <sd/se> <filetype> [steamid] <infile> <outfile>\n"\
+         "        same, but streamed through small buffers so that memory use\n"\
+         "        stays at a few MB regardless of file size\n"\
+         "\n"\
+         "       inti_encdec <bd/be> <indir> <outdir>\n"\
+         "        decode/encode every file under indir into the same place under\n"\
+         "        outdir, using all cpus. filetypes are picked by file extension:\n"\
+         "        .bfb .osb .scb .stb .bisar .ttb .tb2\n"\
+         "        when decoding, other files are tried as compressed filetypes\n"\
+         "\n"\
+         "       inti_encdec xi <filetype> [steamid] <infile> <indexfile>\n"\
+         "        build a keystream index for an uncompressed filetype, e.g.\n"\
+         "        <infile>.idx, so that parts of it can be decoded quickly\n"\
+         "\n"\
+         "       inti_encdec xr <filetype> [steamid] <infile> <outfile> <offset> <length> [indexfile]\n"\
+         "        decode only bytes offset..offset+length-1 of infile, starting\n"\
+         "        at the nearest checkpoint of indexfile if one is given\n"\
+         "\n"\
+         "       inti_encdec sr <filetype> <infile> [known plaintext]\n"\
+         "        find the steamid a save file was scrambled with by trying all\n"\
+         "        2^32 of them. known plaintext is the start of the decoded data\n"\
+         "        after the header in hex (e.g. from another save of the game),\n"\
+         "        without it the decoded data is checked for looking like a save.\n"\
+         "        that takes about 10-20 cpu minutes (spread over all cpus), with\n"\
+         "        known plaintext it is done in well under a minute\n"\
+         "\n"\
+         "       inti_encdec pw <infile> <template> [wordlist]\n"\
+         "        search the password of a file of an unknown type using all cpus.\n"\
+         "        the template is the password with these placeholders:\n"\
+         "         ?w word from wordlist (one per line)  ?d 0-9  ?h 0-9a-f\n"\
+         "         ?l a-z  ?u A-Z  ?a a-zA-Z0-9  ?? a '?'\n"\
+         "        e.g. \"?w90210\" or \"?w20?d?d?d?d?d?d\"\n"\
+         "\n"\
+         "       inti_encdec zt <infile>\n"\
+         "        check that every compiled-in deflate backend decodes the output\n"\
+         "        of every other one back to the contents of infile\n"\
+         "\n"\
+         "       options, in front of the command:\n"\
+         "        -z <backend>  deflate backend to use: zlib (default), zlib-ng,\n"\
+         "                      libdeflate (the latter two if compiled in)\n"\
+         "        -l <level>    compression level when encoding, 0-9 (0-12 with\n"\
+         "                      libdeflate) or one of:\n"\
+         "                       store    0, stored blocks, fastest to rebuild\n"\
+         "                       fast     1, for quick test builds\n"\
+         "                       default  9, what the games ship with\n"\
+         "                       max      highest level of the backend\n"\
+         "                       search   try many deflate setups on all cpus and\n"\
+         "                                keep the smallest (slow, for releases;\n"\
+         "                                sd/se/bd/be use level 9 instead)\n"\
+         "        -s <strategy> zlib strategy: default, filtered, huffman, rle, fixed\n"\
+         "        -c <dir>      keep converted files in a cache directory and copy\n"\
+         "                      or link them from there when the same input is\n"\
+         "                      converted again with the same settings (d/e,\n"\
+         "                      sd/se, bd/be). the INTI_CACHE environment\n"\
+         "                      variable sets a default\n"\
          /*"\n"\
          "        inti_encdec <lt>\n"\
          "        list predefined filetypes\n"\
@@ -132,34 +180,363 @@ enum
   MODE_ENC
 };
 
+int BuildIndex (char *inpath, char *indexpath, int headerskip, uint64_t key1, uint64_t key2)
+{
+  mmapinfo_t *mminfile;
+  seekidx_t idx;
+  int r;
+
+  mminfile = mmap_existing_read(inpath);
+  if (!mminfile)
+  {
+    printf("failed to memory map input file '%s'\n", inpath);
+    return -1;
+  }
+
+  r = inti_index_build(&idx, mminfile->ptr, mminfile->size, headerskip, key1, key2, SEEKIDX_INTERVAL);
+  close_mmapping(mminfile);
+
+  if (!r)
+  {
+    r = inti_index_save(&idx, indexpath);
+    if (!r)
+      printf("indexed %"PRIu64" bytes, %u checkpoints every %u KB\n", idx.filesize, idx.count, idx.interval/1024);
+
+    inti_index_free(&idx);
+  }
+
+  return r;
+}
+
+int DecodeRange (char *inpath, char *outpath, char *indexpath, int headerskip, uint64_t key1, uint64_t key2, uint64_t offset, uint64_t length)
+{
+  mmapinfo_t *mminfile, *mmoutfile;
+  seekidx_t idx, *useidx;
+  int r;
+
+  mminfile = mmap_existing_read(inpath);
+  if (!mminfile)
+  {
+    printf("failed to memory map input file '%s'\n", inpath);
+    return -1;
+  }
+
+  useidx = NULL;
+  if (indexpath)
+  {
+    if (inti_index_load(&idx, indexpath))
+      printf("can't use index '%s', decoding from the start\n", indexpath);
+    else if (inti_index_check(&idx, mminfile->ptr, mminfile->size, headerskip, key1, key2, offset))
+    {
+      printf("not using index '%s', decoding from the start\n", indexpath);
+      inti_index_free(&idx);
+    }
+    else
+      useidx = &idx;
+  }
+
+  if (offset > mminfile->size || length > mminfile->size - offset)
+  {
+    printf("range %"PRIu64"+%"PRIu64" is outside of the file (%"PRIu64" bytes)\n", offset, length, (uint64_t)mminfile->size);
+    r = -1;
+  }
+  else if (!(mmoutfile = mmap_create_overwrite(outpath, length)))
+  {
+    printf("failed to memory map output file '%s'\n", outpath);
+    r = -1;
+  }
+  else
+  {
+    r = inti_index_decode(useidx, mminfile->ptr, mminfile->size, headerskip, key1, key2, offset, length, mmoutfile->ptr);
+    close_mmapping(mmoutfile);
+
+    if (!r)
+      printf("decoded %"PRIu64" bytes at offset %"PRIu64"%s\n", length, offset, useidx ? " using the index" : "");
+  }
+
+  if (useidx)
+    inti_index_free(useidx);
+
+  close_mmapping(mminfile);
+  return r;
+}
+
+int RecoverSteamID (const inti_filetype_t *predef, char *inpath, char *knownhex)
+{
+  mmapinfo_t *mminfile;
+  steamid_hit_t hits[STEAMID_MAXHITS];
+  uint8_t *known;
+  size_t knownlen, i;
+  unsigned int byte;
+  double start, secs;
+  int numhits;
+
+  known = NULL;
+  knownlen = 0;
+  if (knownhex)
+  {
+    knownlen = strlen(knownhex)/2;
+    known = malloc(knownlen ? knownlen : 1);
+    if (!known || !knownlen || strlen(knownhex) % 2)
+    {
+      printf("known plaintext must be an even number of hex digits\n");
+      free(known);
+      return -1;
+    }
+
+    for (i=0; i<knownlen; i++)
+    {
+      if (sscanf(knownhex + i*2, "%2x", &byte) != 1)
+      {
+        printf("bad hex digits in known plaintext\n");
+        free(known);
+        return -1;
+      }
+      known[i] = byte;
+    }
+  }
+
+  mminfile = mmap_existing_read(inpath);
+  if (!mminfile)
+  {
+    printf("failed to memory map input file '%s'\n", inpath);
+    free(known);
+    return -1;
+  }
+
+  if (mminfile->size <= predef->headerskip)
+  {
+    printf("input file is too short\n");
+    close_mmapping(mminfile);
+    free(known);
+    return -1;
+  }
+
+  printf("searching %s steamids...\r", predef->shorthand); fflush(stdout);
+
+  start = wallclock();
+  numhits = inti_find_steamid((uint8_t*)mminfile->ptr + predef->headerskip, mminfile->size - predef->headerskip,
+                              predef->password1, predef->password2, known, knownlen, 0, hits);
+  secs = wallclock()-start;
+
+  close_mmapping(mminfile);
+  free(known);
+
+  if (numhits < 0)
+    return -1;
+
+  printf("searched 2^32 ids in %.1f s (%.1f M ids/s)\n", secs, 4294967296.0/secs/1e6);
+
+  // best first, a short known plaintext lets some wrong ids through, but their score stays low
+  for (i=0; i<(size_t)numhits && i<10; i++)
+    printf("steamid %"PRIu64" (account id %u), score %i\n", (uint64_t)(STEAMID_BASE + hits[i].id), hits[i].id, hits[i].score);
+
+  if (numhits > 10)
+    printf("... and %i less likely ones\n", numhits-10);
+
+  if (!numhits)
+    printf("no plausible steamid found\n");
+
+  return numhits ? 0 : -1;
+}
+
+int FindPassword (char *inpath, char *pattern, char *wordpath)
+{
+  mmapinfo_t *mminfile;
+  crack_hit_t hits[CRACK_MAXHITS];
+  crack_stats_t stats;
+  char **words, line[256];
+  int numwords, maxwords, numhits, i, l;
+  FILE *fp;
+
+  words = NULL;
+  numwords = maxwords = 0;
+
+  if (wordpath)
+  {
+    fp = fopen(wordpath, "r");
+    if (!fp)
+    {
+      printf("failed to open wordlist '%s'\n", wordpath);
+      return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+      l = strlen(line);
+      while (l && (line[l-1] == '\n' || line[l-1] == '\r'))
+        line[--l] = 0;
+
+      if (!l)
+        continue;
+
+      if (numwords == maxwords)
+      {
+        maxwords = maxwords ? maxwords*2 : 1024;
+        words = realloc(words, sizeof(char*)*maxwords);
+      }
+
+      if (!words || !(words[numwords++] = strdup(line)))
+      {
+        printf("failed to allocate memory for wordlist\n");
+        return -1;
+      }
+    }
+
+    fclose(fp);
+  }
+
+  mminfile = mmap_existing_read(inpath);
+  if (!mminfile)
+  {
+    printf("failed to memory map input file '%s'\n", inpath);
+    return -1;
+  }
+
+  numhits = inti_crack(mminfile->ptr, mminfile->size, pattern, words, numwords, 0, hits, &stats);
+  close_mmapping(mminfile);
+
+  for (i=0; i<numwords; i++)
+    free(words[i]);
+  free(words);
+
+  if (numhits < 0)
+    return -1;
+
+  printf("tried %"PRIu64" candidates in %.1f s (%.2f M/s)\n", stats.tried, stats.seconds,
+         stats.seconds > 0 ? stats.tried/stats.seconds/1e6 : 0.0);
+
+  for (i=0; i<numhits && i<10; i++)
+    printf("score %3i: %s\n", hits[i].score, hits[i].password);
+
+  if (!numhits)
+    printf("no password found\n");
+
+  return numhits ? 0 : -1;
+}
+
 int main (int argc, char **argv)
 {
   char *command;
 
   int r;
   int mode; // 0=decoding, 1=encoding
+  int streaming;
+  int argi; // first argument after the paths
   int compressed, headerskip;
   uint64_t key1, key2;
 
   mmapinfo_t *mminfile, *mmoutfile;
   //int inlength, outlength, zlength;
-  byte *inbuf, *outbuf, *zbuf;
+  byte *inbuf, *outbuf;
 
   char *inpath, *outpath;
+  cachekey_t cachekey;
+  int caching;
 
 
-  if (argc < 5)
+  if (getenv("INTI_CACHE") && *getenv("INTI_CACHE") && cache_set_dir(getenv("INTI_CACHE")))
+  {
+    printf("failed to create cache directory '%s'\n", getenv("INTI_CACHE"));
+    return -1;
+  }
+
+  // options in front of the command
+  while (argc > 2 && argv[1][0] == '-')
+  {
+    if (!stricmp(argv[1], "-z"))
+    {
+      if (zback_select(argv[2]))
+      {
+        printf("deflate backend '%s' is unknown or not compiled in\n", argv[2]);
+        return -1;
+      }
+    }
+    else if (!stricmp(argv[1], "-l"))
+    {
+      if (zback_set_level(argv[2]))
+      {
+        printf("bad compression level '%s'\n", argv[2]);
+        return -1;
+      }
+    }
+    else if (!stricmp(argv[1], "-s"))
+    {
+      if (zback_set_strategy(argv[2]))
+      {
+        printf("bad compression strategy '%s'\n", argv[2]);
+        return -1;
+      }
+    }
+    else if (!stricmp(argv[1], "-c"))
+    {
+      if (cache_set_dir(argv[2]))
+      {
+        printf("failed to create cache directory '%s'\n", argv[2]);
+        return -1;
+      }
+    }
+    else
+      ShowUsage();
+
+    argv += 2;
+    argc -= 2;
+  }
+
+  // compare deflate backends on a file
+  if (argc == 3 && !stricmp(argv[1], "zt"))
+  {
+    mminfile = mmap_existing_read(argv[2]);
+    if (!mminfile)
+    {
+      printf("failed to memory map input file '%s'\n", argv[2]);
+      return -1;
+    }
+
+    r = zback_selftest(mminfile->ptr, mminfile->size, zback_level());
+    close_mmapping(mminfile);
+
+    printf("%s\n", r ? "backends DISAGREE" : "all backends agree");
+    return r ? -1 : 0;
+  }
+
+  if (argc < 4)
     ShowUsage();
 
   command = argv[1];
 
+  // search the password of an unknown filetype
+  if (!stricmp(command, "pw"))
+    return FindPassword(argv[2], argv[3], (argc > 4) ? argv[4] : NULL);
+
+  // recover the steamid of a save
+  if (!stricmp(command, "sr"))
+    return RecoverSteamID(&FileTypes[GetIntiFileType(argv[2])], argv[3], (argc > 4) ? argv[4] : NULL);
+
+  // convert a whole directory tree
+  if (!stricmp(command, "bd") || !stricmp(command, "be"))
+    return inti_batch(argv[2], argv[3], !stricmp(command, "be"), 0) ? -1 : 0;
+
+  if (argc < 5)
+    ShowUsage();
+
+  streaming = 0;
+  if (!stricmp(command, "sd") || !stricmp(command, "se"))
+  {
+    streaming = 1;
+    command++;
+  }
+
   // decode or encode using a predefined filetype
-  if (!stricmp(command, "d") || !stricmp(command,"e"))
+  if (!stricmp(command, "d") || !stricmp(command,"e") || !stricmp(command, "xi") || !stricmp(command, "xr"))
   {
     int typeindex;
     const inti_filetype_t *predef;
 
-    predef = &FileTypes[GetIntiFileType(argv[2])];
+    if (!stricmp(argv[2], "auto") && stricmp(command, "e"))
+      predef = &FileTypes[DetectIntiFileType(argv[3])];
+    else
+      predef = &FileTypes[GetIntiFileType(argv[2])];
 
     compressed = predef->compressed;
     headerskip = predef->headerskip;
@@ -194,6 +571,7 @@ int main (int argc, char **argv)
 
       inpath = argv[4];
       outpath = argv[5];
+      argi = 6;
 	}
 	else
 	{
@@ -206,6 +584,7 @@ int main (int argc, char **argv)
 
       inpath = argv[3];
       outpath = argv[4];
+      argi = 5;
 	}
 
     if (!stricmp(command, "e"))
@@ -228,26 +607,121 @@ int main (int argc, char **argv)
     return -1;
   }
 
-  mminfile = mmap_existing_read_cow(inpath);
+  // random access into uncompressed filetypes
+  if (!stricmp(command, "xi") || !stricmp(command, "xr"))
+  {
+    if (compressed)
+    {
+      printf("only uncompressed filetypes can be indexed, '%s' is compressed\n", argv[2]);
+      return -1;
+    }
+
+    if (!stricmp(command, "xi"))
+      return BuildIndex(inpath, outpath, headerskip, key1, key2) ? -1 : 0;
+
+    if (argc < argi+2)
+      ShowUsage();
+
+    return DecodeRange(inpath, outpath, (argc > argi+2) ? argv[argi+2] : NULL, headerskip, key1, key2,
+                       strtoull(argv[argi], NULL, 0), strtoull(argv[argi+1], NULL, 0)) ? -1 : 0;
+  }
+
+  // an unchanged input converted the same way before is taken from the cache
+  caching = 0;
+  if (cache_enabled())
+  {
+    char settings[160];
+    uint64_t size;
+
+    cache_conv_settings(settings, sizeof(settings), mode == MODE_ENC, streaming, compressed, headerskip, key1, key2);
+
+    if (!cache_key_file(&cachekey, inpath, settings))
+    {
+      if (!cache_fetch(&cachekey, outpath, &size))
+      {
+        printf("%s from cache, output is %"PRIu64" bytes\n", mode == MODE_ENC ? "encoded" : "decoded", size);
+        return 0;
+      }
+
+      caching = 1;
+    }
+  }
+
+  if (streaming)
+  {
+    uint64_t total, written;
+    double start;
+
+    printf("%s...\r", mode == MODE_ENC ? "encoding" : "decoding"); fflush(stdout);
+
+    start = wallclock();
+    if (inti_stream_file(inpath, outpath, mode == MODE_ENC, compressed, headerskip, key1, key2, &total, &written))
+      return -1;
+
+    printf("%s %"PRIu64" bytes, output is %"PRIu64" bytes (%.2f s)\n", mode == MODE_ENC ? "encoded" : "decoded", total, written, wallclock()-start);
+
+    if (caching)
+      cache_store(&cachekey, outpath);
+    return 0;
+  }
+
+  mminfile = mmap_existing_read(inpath);
   if (!mminfile)
   {
     printf("failed to memory map input file '%s'\n", inpath);
     return -1;
   }
 
+  if (compressed && mode == MODE_DEC && mminfile->size < sizeof(uint32_t))
+  {
+    printf("input file is too short\n");
+    return -1;
+  }
+
+  if (compressed && mode == MODE_ENC && mminfile->size > UINT32_MAX)
+  {
+    printf("input file is too large for the 32-bit length header\n");
+    return -1;
+  }
+
+  if (headerskip && mminfile->size < (size_t)headerskip)
+  {
+    printf("input file is too short\n");
+    return -1;
+  }
+
+  // with plain zlib, bigger inputs are deflated in independent blocks anyway, so the
+  // blocks can be scrambled and written while later ones are still being read and
+  // deflated, rather than every stage waiting for the whole file
+  if (compressed && mode == MODE_ENC && zback_current() == ZBACK_ZLIB && zback_level() != ZBACK_LEVEL_SEARCH
+      && mminfile->size > 2*PZ_BLOCKSIZE)
+  {
+    uint64_t insize, written;
+    double start;
+
+    insize = mminfile->size;
+    close_mmapping(mminfile);
+
+    printf("encoding...\r"); fflush(stdout);
+
+    start = wallclock();
+    if (inti_pipeline_encode(inpath, outpath, compressed, key1, key2, 0, NULL, &written))
+      return -1;
+
+    printf("compressed and scrambled %"PRIu64" => %"PRIu64" bytes, %s, pipelined (%.2f s)\n", insize, written, zback_describe(), wallclock()-start);
+
+    if (caching)
+      cache_store(&cachekey, outpath);
+    return 0;
+  }
+
+  // the input mapping is read only and never written to, results go straight into the
+  // output mapping. compressed output gets a mapping of the deflate bound that is cut
+  // to size afterwards
   if (mode == MODE_DEC)
   {
     if (!compressed)
     {
-	  printf("descrambling...\r"); fflush(stdout);
-	  
-	  inti_encdec((byte*)mminfile->ptr+headerskip, ENCDEC_MODE_DEC, mminfile->size-headerskip, key1);
-      if (key2)
-        inti_encdec((byte*)mminfile->ptr+headerskip, ENCDEC_MODE_DEC, mminfile->size-headerskip, key2);
-	
-	  printf("descrambled %i bytes\n", mminfile->size-headerskip);
-	  
-
       mmoutfile = mmap_create_overwrite(outpath, mminfile->size);
       if (!mmoutfile)
       {
@@ -255,12 +729,23 @@ int main (int argc, char **argv)
         return -1;
       }
 
+      printf("descrambling...\r"); fflush(stdout);
+
       memcpy(mmoutfile->ptr, mminfile->ptr, mminfile->size);
+
+      if (key2)
+        inti_dec2_mt((byte*)mmoutfile->ptr+headerskip, mminfile->size-headerskip, key1, key2, 0);
+      else
+        inti_dec_mt((byte*)mmoutfile->ptr+headerskip, mminfile->size-headerskip, key1, 0);
+
+      printf("descrambled %"PRIu64" bytes\n", (uint64_t)(mminfile->size-headerskip));
+
       close_mmapping(mmoutfile);
     }
     else if (compressed == COMP_REVERSE) // zlib decompress first, then descramble (DMFD PC JSONs)
     {
       uint32_t unzsize;
+      size_t outlen;
 
       // first 4 bytes is uncompressed length
       memcpy(&unzsize, mminfile->ptr, sizeof(uint32_t));
@@ -275,38 +760,44 @@ int main (int argc, char **argv)
 
       printf("uncompressing...\r"); fflush(stdout);
 	  
-	  r = uncompress(mmoutfile->ptr, (uLongf*)&unzsize, (byte*)mminfile->ptr+sizeof(uint32_t), mminfile->size-sizeof(uint32_t));
+	  outlen = unzsize;
+	  r = zback_uncompress(mmoutfile->ptr, &outlen, (byte*)mminfile->ptr+sizeof(uint32_t), mminfile->size-sizeof(uint32_t));
+	  unzsize = outlen;
       if (r != Z_OK)
       {
         printf("zlib decompression failed, error code %i\n", r);
         return -1;
       }
 	  
-	  printf("uncompressed %i => %i bytes\n", mminfile->size-sizeof(uint32_t), unzsize);	  
+	  printf("uncompressed %"PRIu64" => %u bytes\n", (uint64_t)(mminfile->size-sizeof(uint32_t)), unzsize);	  
 
       printf("descrambling...\r"); fflush(stdout);
 	  
-	  inti_encdec(mmoutfile->ptr, ENCDEC_MODE_DEC, unzsize, key1);
-      if (key2)
-        inti_encdec(mmoutfile->ptr, ENCDEC_MODE_DEC, unzsize, key2);
+	  if (key2)
+        inti_dec2_mt(mmoutfile->ptr, unzsize, key1, key2, 0);
+      else
+        inti_dec_mt(mmoutfile->ptr, unzsize, key1, 0);
 
-      printf("descrambled %i bytes\n", unzsize);
+      printf("descrambled %u bytes\n", unzsize);
 	  
       close_mmapping(mmoutfile);
     }
-    else // descramble first, then zlib decompress (everything else so far)
+    else // descramble and zlib decompress in one go (everything else so far)
     {
+      inti_cspan_t in;
+      inti_span_t out;
+      byte header[sizeof(uint32_t)];
       uint32_t unzsize;
+      size_t outlen;
+
+      memcpy(header, mminfile->ptr, sizeof(uint32_t));
 
-      printf("descrambling...\r"); fflush(stdout);
-	  
-	  inti_encdec(mminfile->ptr, ENCDEC_MODE_DEC, mminfile->size, key1);
       if (key2)
-        inti_encdec(mminfile->ptr, ENCDEC_MODE_DEC, mminfile->size, key2);
-	
-	  printf("descrambled %i bytes\n", mminfile->size);
+        inti_encdec2(header, ENCDEC_MODE_DEC, sizeof(uint32_t), key1, key2);
+      else
+        inti_encdec(header, ENCDEC_MODE_DEC, sizeof(uint32_t), key1);
 
-      memcpy(&unzsize, mminfile->ptr, sizeof(uint32_t));
+      memcpy(&unzsize, header, sizeof(uint32_t));
 
       mmoutfile = mmap_create_overwrite(outpath, unzsize);
       if (!mmoutfile)
@@ -314,33 +805,31 @@ int main (int argc, char **argv)
         printf("failed to memory map output file '%s'\n", outpath);
         return -1;
       }
-	  
-	  printf("uncompressing...\r"); fflush(stdout);
 
-      r = uncompress(mmoutfile->ptr, (uLongf*)&unzsize, (byte*)mminfile->ptr+sizeof(uint32_t), mminfile->size-sizeof(uint32_t));
-      if (r != Z_OK)
+      printf("descrambling and uncompressing...\r"); fflush(stdout);
+
+      // the compressed data is descrambled through a small window on its way into inflate
+      in.ptr = mminfile->ptr;
+      in.len = mminfile->size;
+      out.ptr = mmoutfile->ptr;
+      out.len = unzsize;
+
+      r = inti_decode_keys(compressed, 0, key1, key2, in, out, &outlen);
+      close_mmapping(mmoutfile);
+
+      if (r != INTI_OK)
       {
-        printf("zlib decompression failed, error code %i\n", r);
+        printf("decoding failed: %s\n", inti_strerror(r));
         return -1;
       }
-	  
-	  printf("uncompressed %i => %i bytes\n", mminfile->size-sizeof(uint32_t), unzsize);
 
-      close_mmapping(mmoutfile);
+      printf("uncompressed %"PRIu64" => %"PRIu64" bytes\n", (uint64_t)(mminfile->size-sizeof(uint32_t)), (uint64_t)outlen);
     }
   }
   else // mode ENC(ode)
   {
     if (!compressed)
     {
-      printf("scrambling...\r"); fflush(stdout);
-	  
-	  inti_encdec((byte*)mminfile->ptr+headerskip, ENCDEC_MODE_ENC, mminfile->size-headerskip, key1);
-      if (key2)
-        inti_encdec((byte*)mminfile->ptr+headerskip, ENCDEC_MODE_ENC, mminfile->size-headerskip, key2);
-	  
-	  printf("scrambled %i bytes\n", mminfile->size-headerskip);
-
       mmoutfile = mmap_create_overwrite(outpath, mminfile->size);
       if (!mmoutfile)
       {
@@ -348,101 +837,100 @@ int main (int argc, char **argv)
         return -1;
       }
 
+      printf("scrambling...\r"); fflush(stdout);
+
       memcpy(mmoutfile->ptr, mminfile->ptr, mminfile->size);
+
+      if (key2)
+        inti_encdec2((byte*)mmoutfile->ptr+headerskip, ENCDEC_MODE_ENC, mminfile->size-headerskip, key1, key2);
+      else
+        inti_encdec((byte*)mmoutfile->ptr+headerskip, ENCDEC_MODE_ENC, mminfile->size-headerskip, key1);
+	  
+      printf("scrambled %"PRIu64" bytes\n", (uint64_t)(mminfile->size-headerskip));
+
       close_mmapping(mmoutfile);
     }
-    else if (compressed == COMP_REVERSE) // first scramble, then compress (DMFD PC JSON files)
+    else // compress, scrambling before (DMFD PC JSON files) or after (everything else...)
     {
-      uint32_t zsize;
-      
-      printf("scrambling...\r"); fflush(stdout);
-	  
-	  inti_encdec(mminfile->ptr, ENCDEC_MODE_ENC, mminfile->size, key1);
-      if (key2)
-        inti_encdec(mminfile->ptr, ENCDEC_MODE_ENC, mminfile->size, key2);
-		
-      printf("scrambled %i bytes\n", mminfile->size);
-      
-      zsize = compressBound(mminfile->size);
-      zbuf = malloc(zsize + sizeof(uint32_t)); // leave space for header
-      if (!zbuf)
+      uint32_t unzsize;
+      size_t zsize;
+      byte *source;
+      double start;
+
+      // scrambling before compression needs a writable copy of the input
+      source = mminfile->ptr;
+      if (compressed == COMP_REVERSE)
+      {
+        source = malloc(mminfile->size ? mminfile->size : 1);
+        if (!source)
+        {
+          printf("failed to allocate memory for scrambling buffer\n");
+          return -1;
+        }
+
+        printf("scrambling...\r"); fflush(stdout);
+
+        memcpy(source, mminfile->ptr, mminfile->size);
+
+        if (key2)
+          inti_encdec2(source, ENCDEC_MODE_ENC, mminfile->size, key1, key2);
+        else
+          inti_encdec(source, ENCDEC_MODE_ENC, mminfile->size, key1);
+
+        printf("scrambled %"PRIu64" bytes\n", (uint64_t)mminfile->size);
+      }
+
+      zsize = zback_bound(mminfile->size);
+      mmoutfile = mmap_create_overwrite(outpath, zsize+sizeof(uint32_t)); // leave space for header
+      if (!mmoutfile)
       {
-        printf("failed to allocate memory for zlib compression buffer\n");
+        printf("failed to memory map output file '%s'\n", outpath);
         return -1;
       }
 
       printf("compressing...\r"); fflush(stdout);
 	  
-	  r = compress2(zbuf+sizeof(uint32_t), (uLongf*)&zsize, mminfile->ptr, mminfile->size, 9);
+      start = wallclock();
+      r = zback_compress((byte*)mmoutfile->ptr+sizeof(uint32_t), &zsize, source, mminfile->size, zback_level());
+
+      if (source != mminfile->ptr)
+        free(source);
+
       if (r != Z_OK)
       {
         printf("zlib compression failed, error code %i\n", r);
         return -1;
       }
 	  
-	  printf("compressed %i => %i bytes\n", mminfile->size, zsize);
+      printf("compressed %"PRIu64" => %"PRIu64" bytes, %s (%.2f s)\n", (uint64_t)mminfile->size, (uint64_t)zsize, zback_describe(), wallclock()-start);
 
       // add header for decompressed size
-      memcpy(zbuf, &mminfile->size, sizeof(uint32_t));
+      unzsize = mminfile->size;
+      memcpy(mmoutfile->ptr, &unzsize, sizeof(uint32_t));
 
-      mmoutfile = mmap_create_overwrite(outpath, zsize+sizeof(uint32_t));
-      if (!mmoutfile)
+      if (compressed == COMP_YES)
       {
-        printf("failed to memory map output file '%s'\n", outpath);
-        return -1;
-      }
-
-      memcpy(mmoutfile->ptr, zbuf, zsize+sizeof(uint32_t));
-      close_mmapping(mmoutfile);
-      free(zbuf);
-    }
-    else // first compress, then scramble (everything else...)
-    {
-      uint32_t zsize;
+        printf("scrambling...\r"); fflush(stdout);
 
-      zsize = compressBound(mminfile->size);
-      zbuf = malloc(zsize + sizeof(uint32_t)); // leave space for header
-      if (!zbuf)
-      {
-        printf("failed to allocate memory for zlib compression buffer\n");
-        return -1;
-      }
+        if (key2)
+          inti_encdec2(mmoutfile->ptr, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key1, key2);
+        else
+          inti_encdec(mmoutfile->ptr, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key1);
 
-      printf("compressing...\r"); fflush(stdout);
-	  
-	  r = compress2(zbuf+sizeof(uint32_t), (uLongf*)&zsize, mminfile->ptr, mminfile->size, 9);
-      if (r != Z_OK)
-      {
-        printf("zlib compression failed, error code %i\n", r);
-        return -1;
+        printf("scrambled %"PRIu64" bytes\n", (uint64_t)(zsize+sizeof(uint32_t)));
       }
-	  
-	  printf("compressed %i => %i bytes\n", mminfile->size, zsize);
-	  
-	  // add header for decompressed size
-	  memcpy(zbuf, &mminfile->size, sizeof(uint32_t));
 
-      printf("scrambling...\r"); fflush(stdout);
-	  
-	  inti_encdec(zbuf, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key1);
-      if (key2)
-        inti_encdec(zbuf, ENCDEC_MODE_ENC, zsize+sizeof(uint32_t), key2);
-		
-	  printf("scrambled %i bytes\n", zsize+sizeof(uint32_t));
-      
-      mmoutfile = mmap_create_overwrite(outpath, zsize+sizeof(uint32_t));
-      if (!mmoutfile)
+      if (close_mmapping_truncate(mmoutfile, zsize+sizeof(uint32_t)))
       {
-        printf("failed to memory map output file '%s'\n", outpath);
+        printf("failed to cut output file '%s' to %"PRIu64" bytes\n", outpath, (uint64_t)(zsize+sizeof(uint32_t)));
         return -1;
       }
-
-      memcpy(mmoutfile->ptr, zbuf, zsize+sizeof(uint32_t));
-      close_mmapping(mmoutfile);
-      free(zbuf);
     }
   }
 
-  close_mmapping(mminfile);    
+  close_mmapping(mminfile);
+
+  if (caching)
+    cache_store(&cachekey, outpath);
   return 0;
 }
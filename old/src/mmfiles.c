@@ -1,16 +1,29 @@
 //
 // portable memory mapped files
 //
+// sizes are 64-bit all the way (size_t for the mappings, off_t/LARGE_INTEGER for
+// the files), so inputs above 2/4 GB map fine on 64-bit builds. output files are
+// sized with ftruncate and their blocks reserved with fallocate where there is
+// one, rather than by writing zeros, and both kinds of mapping are hinted as
+// read/written front to back. empty files are not mapped at all (ptr is NULL),
+// neither mmap nor MapViewOfFile accept a length of 0
+//
+
+#ifndef _WIN32
+  #define _GNU_SOURCE // fallocate
+  #define _FILE_OFFSET_BITS 64
+#endif
 
 #include <stddef.h>
 #include <malloc.h>
 #include <stdint.h>
+#include <string.h>
 
 #ifdef _WIN32
   #define WIN32_LEAN_AND_MEAN
   #include <windows.h>
 #else
-  #include <string.h>
+  #include <errno.h>
   #include <unistd.h>
   #include <sys/types.h>
   #include <sys/stat.h>
@@ -22,85 +35,122 @@
 
 #ifdef _WIN32
 
-// read only, copy on write, no commit back to disk
-mmapinfo_t *mmap_existing_read_cow(char *filename)
+static mmapinfo_t *map_existing (char *filename, DWORD viewaccess)
 {
   HANDLE filehandle;
   HANDLE maphandle;
   LPVOID mapptr;
-  DWORD filesize;
+  LARGE_INTEGER filesize;
   mmapinfo_t *mnfo;
-  
-  filehandle = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  filehandle = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN, NULL);
   if (filehandle == INVALID_HANDLE_VALUE)
     return NULL;
-    
-  filesize = GetFileSize(filehandle, NULL);
 
-  maphandle = CreateFileMapping(filehandle, NULL, PAGE_READONLY, 0, 0, NULL);
-  if (!maphandle)
+  if (!GetFileSizeEx(filehandle, &filesize) || (uint64_t)filesize.QuadPart > (size_t)-1)
   {
     CloseHandle(filehandle);
     return NULL;
   }
-  
-  mapptr = MapViewOfFile(maphandle, FILE_MAP_COPY, 0,0,0);
-  if (!mapptr)
+
+  maphandle = NULL;
+  mapptr = NULL;
+
+  if (filesize.QuadPart)
   {
-    CloseHandle(maphandle);
-    CloseHandle(filehandle); 
-    return NULL;
+    maphandle = CreateFileMapping(filehandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!maphandle)
+    {
+      CloseHandle(filehandle);
+      return NULL;
+    }
+
+    mapptr = MapViewOfFile(maphandle, viewaccess, 0,0,0);
+    if (!mapptr)
+    {
+      CloseHandle(maphandle);
+      CloseHandle(filehandle);
+      return NULL;
+    }
   }
 
   mnfo = malloc(sizeof(mmapinfo_t));
   if (!mnfo)
   {
-    UnmapViewOfFile(mapptr);
-    CloseHandle(maphandle);
+    if (mapptr)
+    {
+      UnmapViewOfFile(mapptr);
+      CloseHandle(maphandle);
+    }
     CloseHandle(filehandle);
     return NULL;
   }
-  
+
   mnfo->fh = filehandle;
   mnfo->mh = maphandle;
-  mnfo->size = filesize;
+  mnfo->size = (size_t)filesize.QuadPart;
   mnfo->ptr = mapptr;
   mnfo->path = strdup(filename);
-  
+
   return mnfo;
 }
 
-mmapinfo_t *mmap_create_overwrite(char *filename, int size)
+// read only, the pages are shared with the page cache
+mmapinfo_t *mmap_existing_read(char *filename)
+{
+  return map_existing(filename, FILE_MAP_READ);
+}
+
+// read only, copy on write, no commit back to disk
+mmapinfo_t *mmap_existing_read_cow(char *filename)
+{
+  return map_existing(filename, FILE_MAP_COPY);
+}
+
+mmapinfo_t *mmap_create_overwrite(char *filename, size_t size)
 {
   HANDLE filehandle;
   HANDLE maphandle;
   LPVOID mapptr;
   mmapinfo_t *mnfo;
-  
+
+  // replaced rather than truncated, it may be a hardlink into the conversion cache
+  DeleteFile(filename);
+
   filehandle = CreateFile(filename, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
   if (filehandle == INVALID_HANDLE_VALUE)
     return NULL;
-    
-  maphandle = CreateFileMapping(filehandle, NULL, PAGE_READWRITE, 0, size, NULL);
-  if (!maphandle)
-  {
-    CloseHandle(filehandle);
-    return NULL;
-  }
-  
-  mapptr = MapViewOfFile(maphandle, FILE_MAP_WRITE, 0,0,0);
-  if (!mapptr)
+
+  maphandle = NULL;
+  mapptr = NULL;
+
+  // creating the mapping extends the file to its size
+  if (size)
   {
-    CloseHandle(maphandle);
-    CloseHandle(filehandle); 
-    return NULL;
+    maphandle = CreateFileMapping(filehandle, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if (!maphandle)
+    {
+      CloseHandle(filehandle);
+      return NULL;
+    }
+
+    mapptr = MapViewOfFile(maphandle, FILE_MAP_WRITE, 0,0,0);
+    if (!mapptr)
+    {
+      CloseHandle(maphandle);
+      CloseHandle(filehandle);
+      return NULL;
+    }
   }
 
   mnfo = malloc(sizeof(mmapinfo_t));
   if (!mnfo)
   {
-    UnmapViewOfFile(mapptr);
-    CloseHandle(maphandle);
+    if (mapptr)
+    {
+      UnmapViewOfFile(mapptr);
+      CloseHandle(maphandle);
+    }
     CloseHandle(filehandle);
     return NULL;
   }
@@ -113,19 +163,44 @@ mmapinfo_t *mmap_create_overwrite(char *filename, int size)
 
   return mnfo;
 }
-                     
+
 void close_mmapping(mmapinfo_t *mnfo)
 {
-  UnmapViewOfFile(mnfo->ptr);
-  CloseHandle(mnfo->mh);
+  if (mnfo->ptr)
+  {
+    UnmapViewOfFile(mnfo->ptr);
+    CloseHandle(mnfo->mh);
+  }
+  CloseHandle(mnfo->fh);
+  free(mnfo->path);
+  free(mnfo);
+}
+
+int close_mmapping_truncate(mmapinfo_t *mnfo, size_t size)
+{
+  LARGE_INTEGER pos;
+  int r;
+
+  // the file can only shrink once nothing maps it anymore
+  if (mnfo->ptr)
+  {
+    UnmapViewOfFile(mnfo->ptr);
+    CloseHandle(mnfo->mh);
+  }
+
+  pos.QuadPart = size;
+  r = (SetFilePointerEx(mnfo->fh, pos, NULL, FILE_BEGIN) && SetEndOfFile(mnfo->fh)) ? 0 : -1;
+
   CloseHandle(mnfo->fh);
   free(mnfo->path);
   free(mnfo);
+
+  return r;
 }
 
 #else // not _WIN32
 
-mmapinfo_t *mmap_existing_read_cow(char *filename)
+static mmapinfo_t *map_existing (char *filename, int flags)
 {
   int fd;
   struct stat statbuf;
@@ -137,25 +212,32 @@ mmapinfo_t *mmap_existing_read_cow(char *filename)
   if (fd < 0)
     return NULL;
 
-  if (fstat(fd, &statbuf) < 0)
+  if (fstat(fd, &statbuf) < 0 || (uint64_t)statbuf.st_size > (size_t)-1)
   {
     close(fd);
     return NULL;
   }
 
   filesize = statbuf.st_size;
+  mapptr = NULL;
 
-  mapptr = mmap(NULL, filesize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
-  if (mapptr < 0)
+  if (filesize)
   {
-    close(fd);
-    return NULL;
+    mapptr = mmap(NULL, filesize, (flags == MAP_PRIVATE) ? PROT_READ|PROT_WRITE : PROT_READ, flags, fd, 0);
+    if (mapptr == MAP_FAILED)
+    {
+      close(fd);
+      return NULL;
+    }
+
+    madvise(mapptr, filesize, MADV_SEQUENTIAL);
   }
 
   mnfo = malloc(sizeof(mmapinfo_t));
   if (!mnfo)
   {
-    munmap(mapptr, filesize);
+    if (mapptr)
+      munmap(mapptr, filesize);
     close(fd);
     return NULL;
   }
@@ -165,55 +247,70 @@ mmapinfo_t *mmap_existing_read_cow(char *filename)
   mnfo->ptr = mapptr;
   mnfo->path = strdup(filename);
 
-  return mnfo;  
+  return mnfo;
 }
 
-#define BLOCKSIZE (128*1024)
-static uint8_t nullbuf[BLOCKSIZE];
-static int nullbuf_initialized = 0;
+mmapinfo_t *mmap_existing_read(char *filename)
+{
+  return map_existing(filename, MAP_SHARED);
+}
+
+mmapinfo_t *mmap_existing_read_cow(char *filename)
+{
+  return map_existing(filename, MAP_PRIVATE);
+}
 
-mmapinfo_t *mmap_create_overwrite(char *filename, int size)
+mmapinfo_t *mmap_create_overwrite(char *filename, size_t size)
 {
-  int fd, i;
+  int fd;
   void *mapptr;
   mmapinfo_t *mnfo;
 
-  //chmod(mnfo->path, 0777);
-  //unlink(mnfo->path);
+  // replaced rather than truncated, it may be a hardlink into the conversion cache
+  unlink(filename);
 
-  fd = open(filename, O_RDWR|O_TRUNC|O_CREAT);
+  fd = open(filename, O_RDWR|O_TRUNC|O_CREAT, 0644);
   if (fd < 0)
     return NULL;
-    
-  // is there seriously no better way to do this on not-windows?!?!
-  // (open a mapping that is longer than the actual existing file on disk)
-  if (!nullbuf_initialized)
-  {
-    memset(nullbuf, 0, BLOCKSIZE);
-    nullbuf_initialized = 1;
-  }
-  
-  if (size < BLOCKSIZE)
-    write(fd, nullbuf, size);
-  else
+
+  // a mapping can't grow the file, so give it its size first (sparse)
+  if (ftruncate(fd, (off_t)size) < 0)
   {
-    for (i=0; i<size/BLOCKSIZE; i++)
-      write(fd, nullbuf, BLOCKSIZE);
-    
-    write(fd, nullbuf, size%BLOCKSIZE);
+    close(fd);
+    return NULL;
   }
 
-  mapptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-  if (mapptr < 0)
+#ifdef __linux__
+  // and reserve the blocks, so that running out of disk space fails here and not
+  // with a SIGBUS halfway through writing the mapping. filesystems without
+  // fallocate just stay sparse
+  if (size && fallocate(fd, 0, 0, (off_t)size) < 0 && errno == ENOSPC)
   {
     close(fd);
+    unlink(filename);
     return NULL;
   }
+#endif
+
+  mapptr = NULL;
+
+  if (size)
+  {
+    mapptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapptr == MAP_FAILED)
+    {
+      close(fd);
+      return NULL;
+    }
+
+    madvise(mapptr, size, MADV_SEQUENTIAL);
+  }
 
   mnfo = malloc(sizeof(mmapinfo_t));
   if (!mnfo)
   {
-    munmap(mapptr, size);
+    if (mapptr)
+      munmap(mapptr, size);
     close(fd);
     return NULL;
   }
@@ -222,17 +319,32 @@ mmapinfo_t *mmap_create_overwrite(char *filename, int size)
   mnfo->size = size;
   mnfo->ptr = mapptr;
   mnfo->path = strdup(filename);
-  
-  return mnfo;  
+
+  return mnfo;
 }
 
 void close_mmapping(mmapinfo_t *mnfo)
 {
-  munmap(mnfo->ptr, mnfo->size);
+  if (mnfo->ptr)
+    munmap(mnfo->ptr, mnfo->size);
+  close(mnfo->fh);
+  free(mnfo->path);
+  free(mnfo);
+}
+
+int close_mmapping_truncate(mmapinfo_t *mnfo, size_t size)
+{
+  int r;
+
+  if (mnfo->ptr)
+    munmap(mnfo->ptr, mnfo->size);
+  r = ftruncate(mnfo->fh, (off_t)size);
+
   close(mnfo->fh);
-  chmod(mnfo->path, 0644);
   free(mnfo->path);
   free(mnfo);
+
+  return (r < 0) ? -1 : 0;
 }
 
 #endif // _WIN32
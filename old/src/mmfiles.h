@@ -5,6 +5,8 @@
 #ifndef __MMFILES_H__
 #define __MMFILES_H__
 
+#include <stddef.h>
+
 #ifdef _WIN32
   #define WIN32_LEAN_AND_MEAN
   #include <windows.h>
@@ -20,8 +22,8 @@
   {
     HANDLE fh;
     HANDLE mh;
-    DWORD size;
-    LPVOID ptr;
+    size_t size;
+    LPVOID ptr; // NULL for empty files
     char *path;
   }
   mmapinfo_t;
@@ -30,15 +32,17 @@
   {
     int fh;
     size_t size;
-    void *ptr;
+    void *ptr; // NULL for empty files
     char *path;
   }
   mmapinfo_t;
 #endif
 
+extern mmapinfo_t *mmap_existing_read(char *filename); // read only, the pages are shared with the page cache
 extern mmapinfo_t *mmap_existing_read_cow(char *filename); // read only, copy on write, no commit back to disk
-extern mmapinfo_t *mmap_create_overwrite(char *filename, int size); // read/write, create new file or truncate/overwrite existing
+extern mmapinfo_t *mmap_create_overwrite(char *filename, size_t size); // read/write, create new file or truncate/overwrite existing
 
 extern void close_mmapping(mmapinfo_t *mnfo);
+extern int close_mmapping_truncate(mmapinfo_t *mnfo, size_t size); // for files created with room to spare, cuts them to size. 0 on success
 
 #endif // __MMFILES_H__
@@ -0,0 +1,134 @@
+//
+// multithreaded descrambling
+//
+// pass 1: chunk 0 is descrambled right away (its key is known), all other
+//         chunks only compute their ciphertext term with inti_dec_scan()
+// then:   the start key of every chunk is chained together serially, that's
+//         one multiply and add per chunk
+// pass 2: chunks 1..n-1 are descrambled in parallel
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encdec.h"
+#include "threads.h"
+#include "mtdec.h"
+
+typedef struct
+{
+  uint8_t *buffer;
+  size_t len;
+  size_t pos;
+  uint64_t key;  // start key (pass 2, chunk 0 in pass 1)
+  uint64_t sum;  // result of inti_dec_scan (pass 1)
+  uint64_t next; // key after the last byte (chunk 0 in pass 1)
+  int pass;
+}
+mtdec_chunk_t;
+
+static void mtdec_worker(void *arg)
+{
+  mtdec_chunk_t *chunk = arg;
+
+  if (chunk->pass == 1 && chunk->pos != 0)
+    chunk->sum = inti_dec_scan(chunk->buffer, chunk->len);
+  else
+    chunk->next = inti_dec_from(chunk->buffer, chunk->len, chunk->key, chunk->pos);
+}
+
+// run worker over chunks [first, count), on the calling thread if spawning fails
+static void mtdec_run(mtdec_chunk_t *chunks, int first, int count)
+{
+  thread_t threads[MTDEC_MAXTHREADS];
+  int started[MTDEC_MAXTHREADS];
+  int i;
+
+  for (i=first+1; i<count; i++)
+    started[i] = !thread_start(&threads[i], mtdec_worker, &chunks[i]);
+
+  mtdec_worker(&chunks[first]);
+
+  for (i=first+1; i<count; i++)
+  {
+    if (started[i])
+      thread_join(&threads[i]);
+    else
+      mtdec_worker(&chunks[i]);
+  }
+}
+
+static int mtdec_numthreads(size_t len, int numthreads)
+{
+  if (numthreads <= 0)
+    numthreads = cpu_count();
+  if (numthreads > MTDEC_MAXTHREADS)
+    numthreads = MTDEC_MAXTHREADS;
+
+  if ((size_t)numthreads > len/MTDEC_MINCHUNK)
+    numthreads = len/MTDEC_MINCHUNK;
+
+  return numthreads;
+}
+
+void inti_dec_mt (uint8_t *buffer, size_t len, uint64_t key, int numthreads)
+{
+  mtdec_chunk_t chunks[MTDEC_MAXTHREADS];
+  size_t chunklen, pos;
+  uint64_t pw;
+  int i, count;
+
+  inti_dec_get_simd(); // pick the kernel before any threads race for it
+
+  numthreads = mtdec_numthreads(len, numthreads);
+  if (numthreads <= 1)
+  {
+    inti_dec_from(buffer, len, key, 0);
+    return;
+  }
+
+  // keep chunk boundaries on the 32 byte shift cycle. rounding up from the exact
+  // share makes at most numthreads chunks
+  chunklen = ((len + numthreads-1)/numthreads + 0x1F) & ~(size_t)0x1F;
+
+  count = 0;
+  for (pos=0; pos<len; pos+=chunklen)
+  {
+    chunks[count].buffer = buffer+pos;
+    chunks[count].len = (len-pos < chunklen) ? len-pos : chunklen;
+    chunks[count].pos = pos;
+    chunks[count].key = 0;
+    chunks[count].sum = 0;
+    chunks[count].next = 0;
+    chunks[count].pass = 1;
+    count++;
+  }
+
+  chunks[0].key = key;
+  mtdec_run(chunks, 0, count);
+
+  pw = inti_pow(chunklen);
+  for (i=1; i<count; i++)
+  {
+    if (i == 1)
+      chunks[i].key = chunks[0].next;
+    else
+      chunks[i].key = chunks[i-1].key*pw + chunks[i-1].sum;
+
+    chunks[i].pass = 2;
+  }
+
+  mtdec_run(chunks, 1, count);
+}
+
+void inti_dec2_mt (uint8_t *buffer, size_t len, uint64_t key1, uint64_t key2, int numthreads)
+{
+  // the key2 chain needs the key1 output, so splitting means two full passes
+  if (mtdec_numthreads(len, numthreads) <= 1)
+    inti_encdec2(buffer, ENCDEC_MODE_DEC, len, key1, key2);
+  else
+  {
+    inti_dec_mt(buffer, len, key1, numthreads);
+    inti_dec_mt(buffer, len, key2, numthreads);
+  }
+}
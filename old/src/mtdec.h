@@ -0,0 +1,19 @@
+//
+// multithreaded descrambling, header
+//
+
+#ifndef __MTDEC_H__
+#define __MTDEC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MTDEC_MAXTHREADS 64
+#define MTDEC_MINCHUNK (256*1024) // don't bother splitting below this many bytes per thread
+
+// same result as inti_encdec(buffer, ENCDEC_MODE_DEC, len, key), numthreads <= 0 means one per cpu
+extern void inti_dec_mt (uint8_t *buffer, size_t len, uint64_t key, int numthreads);
+// same for two keys (key1 pass, then key2 pass), fused into one pass when not worth splitting
+extern void inti_dec2_mt (uint8_t *buffer, size_t len, uint64_t key1, uint64_t key2, int numthreads);
+
+#endif // __MTDEC_H__
@@ -0,0 +1,415 @@
+//
+// pipelined encoding of compressed filetypes
+//
+// the one-shot encoder reads the whole file, deflates it, scrambles the whole
+// result and writes it out, one stage after the other. here the input goes
+// through a ring of block slots instead: a reader thread fills them, deflate
+// workers compress them in the same independent blocks pzlib uses, the calling
+// thread scrambles the compressed blocks in order (the key depends on every byte
+// before, so this stage can't be split) and a writer thread writes them out.
+// all stages run at once, so the time is that of the slowest stage, and memory
+// is a few blocks per thread no matter how big the file is
+//
+
+#ifndef _WIN32
+  #define _FILE_OFFSET_BITS 64 // 64-bit ftello/fseeko on 32-bit hosts
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "encdec.h"
+#include "filetypes.h"
+#include "threads.h"
+#include "pzlib.h"
+#include "zback.h"
+#include "pipeline.h"
+
+typedef uint8_t byte;
+
+#ifdef _WIN32
+  #define fseek64 _fseeki64
+  #define ftell64 _ftelli64
+#else
+  #define fseek64 fseeko
+  #define ftell64 ftello
+#endif
+
+#define PIPE_MAXTHREADS 64
+#define PIPE_HEADROOM 8 // in front of the first block, for the size and zlib headers
+#define PIPE_TRAILER 4  // behind the last one, for the adler32
+
+enum
+{
+  SLOT_FREE,
+  SLOT_READ,
+  SLOT_DEFLATING,
+  SLOT_DEFLATED,
+  SLOT_SCRAMBLED
+};
+
+typedef struct
+{
+  int state;
+  int last;
+  byte *in;         // PZ_DICTSIZE bytes of the previous block, then this one
+  uLong inlen, dictlen;
+  byte *out;        // PIPE_HEADROOM, the deflated block and PIPE_TRAILER
+  uLong outlen;
+  uLong adler;      // of the input
+  byte *wptr;       // what the writer writes
+  size_t wlen;
+}
+slot_t;
+
+typedef struct
+{
+  FILE *infp, *outfp;
+  int compressed;
+  int level, strategy;
+  inti_state_t st;
+  uint64_t insize;
+  int64_t numblocks;
+
+  slot_t *slots;
+  int numslots;
+  mutex_t lock;
+  cond_t cond; // broadcast on every state change
+  int64_t nextdeflate;
+  int failed;
+  uint64_t written;
+}
+pipeline_t;
+
+static void fail (pipeline_t *p)
+{
+  mutex_lock(&p->lock);
+  p->failed = 1;
+  cond_broadcast(&p->cond);
+  mutex_unlock(&p->lock);
+}
+
+static void setstate (pipeline_t *p, slot_t *slot, int state)
+{
+  mutex_lock(&p->lock);
+  slot->state = state;
+  cond_broadcast(&p->cond);
+  mutex_unlock(&p->lock);
+}
+
+// returns -1 if the pipeline failed meanwhile
+static int waitstate (pipeline_t *p, slot_t *slot, int state)
+{
+  int r;
+
+  mutex_lock(&p->lock);
+  while (slot->state != state && !p->failed)
+    cond_wait(&p->cond, &p->lock);
+  r = p->failed ? -1 : 0;
+  mutex_unlock(&p->lock);
+
+  return r;
+}
+
+static void reader (void *arg)
+{
+  pipeline_t *p = arg;
+  slot_t *slot, *prev;
+  int64_t i;
+  uint64_t pos;
+
+  prev = NULL;
+  for (i=0; i<p->numblocks; i++)
+  {
+    slot = &p->slots[i % p->numslots];
+    if (waitstate(p, slot, SLOT_FREE))
+      return;
+
+    pos = (uint64_t)i*PZ_BLOCKSIZE;
+    slot->inlen = (p->insize - pos < PZ_BLOCKSIZE) ? (uLong)(p->insize - pos) : PZ_BLOCKSIZE;
+    slot->last = (i == p->numblocks-1);
+
+    // every block but the last is full, and its slot is only reused after this one is read
+    slot->dictlen = prev ? PZ_DICTSIZE : 0;
+    if (prev)
+      memcpy(slot->in, prev->in + PZ_BLOCKSIZE, PZ_DICTSIZE);
+
+    if (fread(slot->in + PZ_DICTSIZE, 1, slot->inlen, p->infp) != slot->inlen || (slot->last && fgetc(p->infp) != EOF))
+    {
+      printf("input file changed while it was being compressed\n");
+      fail(p);
+      return;
+    }
+
+    // json2 is scrambled before it is compressed
+    if (p->compressed == COMP_REVERSE)
+      inti_state_update(&p->st, slot->in + PZ_DICTSIZE, slot->inlen);
+
+    setstate(p, slot, SLOT_READ);
+    prev = slot;
+  }
+}
+
+static void deflater (void *arg)
+{
+  pipeline_t *p = arg;
+  slot_t *slot;
+  int r;
+
+  for (;;)
+  {
+    // blocks are picked up in order, but finish in any order
+    mutex_lock(&p->lock);
+    for (;;)
+    {
+      if (p->failed || p->nextdeflate == p->numblocks)
+      {
+        mutex_unlock(&p->lock);
+        return;
+      }
+
+      slot = &p->slots[p->nextdeflate % p->numslots];
+      if (slot->state == SLOT_READ)
+        break;
+
+      cond_wait(&p->cond, &p->lock);
+    }
+
+    p->nextdeflate++;
+    slot->state = SLOT_DEFLATING;
+    mutex_unlock(&p->lock);
+
+    slot->adler = adler32(adler32(0, NULL, 0), slot->in + PZ_DICTSIZE, slot->inlen);
+    slot->outlen = pz_blockBound(slot->inlen);
+
+    r = pz_deflate_block(slot->out + PIPE_HEADROOM, &slot->outlen, slot->in + PZ_DICTSIZE, slot->inlen, slot->dictlen,
+                         p->level, p->strategy, slot->last);
+    if (r != Z_OK)
+    {
+      printf("zlib compression failed, error code %i\n", r);
+      fail(p);
+      return;
+    }
+
+    setstate(p, slot, SLOT_DEFLATED);
+  }
+}
+
+static void writer (void *arg)
+{
+  pipeline_t *p = arg;
+  slot_t *slot;
+  int64_t i;
+
+  for (i=0; i<p->numblocks; i++)
+  {
+    slot = &p->slots[i % p->numslots];
+    if (waitstate(p, slot, SLOT_SCRAMBLED))
+      return;
+
+    if (fwrite(slot->wptr, 1, slot->wlen, p->outfp) != slot->wlen)
+    {
+      printf("failed to write to output file\n");
+      fail(p);
+      return;
+    }
+
+    p->written += slot->wlen;
+    setstate(p, slot, SLOT_FREE);
+  }
+}
+
+// the stage that has to see every byte in order, on the calling thread
+static int scramble (pipeline_t *p)
+{
+  slot_t *slot;
+  uint32_t unzsize;
+  unsigned int header;
+  uLong adler;
+  byte *ptr;
+  size_t len;
+  int64_t i;
+
+  unzsize = (uint32_t)p->insize;
+  header = pz_header(p->level, p->strategy);
+  adler = adler32(0, NULL, 0);
+
+  for (i=0; i<p->numblocks; i++)
+  {
+    slot = &p->slots[i % p->numslots];
+    if (waitstate(p, slot, SLOT_DEFLATED))
+      return -1;
+
+    ptr = slot->out + PIPE_HEADROOM;
+    len = slot->outlen;
+
+    if (!i)
+    {
+      ptr -= sizeof(uint32_t) + 2;
+      len += sizeof(uint32_t) + 2;
+
+      memcpy(ptr, &unzsize, sizeof(uint32_t));
+      ptr[4] = header >> 8;
+      ptr[5] = header & 0xFF;
+    }
+
+    adler = adler32_combine(adler, slot->adler, slot->inlen);
+
+    if (slot->last)
+    {
+      ptr[len++] = (adler >> 24) & 0xFF;
+      ptr[len++] = (adler >> 16) & 0xFF;
+      ptr[len++] = (adler >> 8) & 0xFF;
+      ptr[len++] = adler & 0xFF;
+    }
+
+    if (p->compressed == COMP_YES)
+      inti_state_update(&p->st, ptr, len);
+
+    slot->wptr = ptr;
+    slot->wlen = len;
+    setstate(p, slot, SLOT_SCRAMBLED);
+  }
+
+  return 0;
+}
+
+static int run (pipeline_t *p, int numthreads)
+{
+  thread_t threads[PIPE_MAXTHREADS+2];
+  int i, started, r;
+
+  started = 0;
+  r = thread_start(&threads[started++], reader, p);
+  if (!r)
+    r = thread_start(&threads[started++], writer, p);
+
+  for (i=0; i<numthreads && !r; i++)
+    r = thread_start(&threads[started++], deflater, p);
+
+  if (r)
+  {
+    started--;
+    printf("failed to start pipeline threads\n");
+    fail(p);
+  }
+  else
+    r = scramble(p);
+
+  for (i=0; i<started; i++)
+    thread_join(&threads[i]);
+
+  return (r || p->failed) ? -1 : 0;
+}
+
+int inti_pipeline_encode (const char *inpath, const char *outpath, int compressed, uint64_t key1, uint64_t key2, int numthreads, uint64_t *total, uint64_t *written)
+{
+  pipeline_t p;
+  int64_t insize;
+  int i, r;
+
+  memset(&p, 0, sizeof(p));
+
+  p.infp = fopen(inpath, "rb");
+  if (!p.infp)
+  {
+    printf("failed to open input file '%s'\n", inpath);
+    return -1;
+  }
+
+  // the header needs the full uncompressed length before any data is written
+  if (fseek64(p.infp, 0, SEEK_END) || (insize = ftell64(p.infp)) < 0 || fseek64(p.infp, 0, SEEK_SET))
+  {
+    printf("failed to get size of input file\n");
+    fclose(p.infp);
+    return -1;
+  }
+
+  if ((uint64_t)insize > UINT32_MAX)
+  {
+    printf("input file is too large for the 32-bit length header\n");
+    fclose(p.infp);
+    return -1;
+  }
+
+  remove(outpath); // may be a hardlink into the conversion cache
+  p.outfp = fopen(outpath, "wb");
+  if (!p.outfp)
+  {
+    printf("failed to open output file '%s'\n", outpath);
+    fclose(p.infp);
+    return -1;
+  }
+
+  if (numthreads <= 0)
+    numthreads = cpu_count();
+  if (numthreads > PIPE_MAXTHREADS)
+    numthreads = PIPE_MAXTHREADS;
+
+  p.compressed = compressed;
+  p.level = zback_level();
+  if (p.level > 9)
+    p.level = 9;
+  p.strategy = zback_strategy();
+  p.insize = insize;
+  p.numblocks = insize ? (insize + PZ_BLOCKSIZE-1) / PZ_BLOCKSIZE : 1;
+  inti_state_init(&p.st, ENCDEC_MODE_ENC, key1, key2);
+
+  // enough for every worker to have a block while the reader and writer have theirs
+  p.numslots = 2*numthreads + 2;
+  p.slots = calloc(p.numslots, sizeof(slot_t));
+
+  r = p.slots ? 0 : -1;
+  for (i=0; i<p.numslots && !r; i++)
+  {
+    p.slots[i].in = malloc(PZ_DICTSIZE + PZ_BLOCKSIZE);
+    p.slots[i].out = malloc(PIPE_HEADROOM + pz_blockBound(PZ_BLOCKSIZE) + PIPE_TRAILER);
+    if (!p.slots[i].in || !p.slots[i].out)
+      r = -1;
+  }
+
+  if (r)
+    printf("failed to allocate memory for pipeline buffers\n");
+  else
+  {
+    mutex_init(&p.lock);
+    cond_init(&p.cond);
+
+    r = run(&p, numthreads);
+
+    cond_destroy(&p.cond);
+    mutex_destroy(&p.lock);
+  }
+
+  if (p.slots)
+  {
+    for (i=0; i<p.numslots; i++)
+    {
+      free(p.slots[i].in);
+      free(p.slots[i].out);
+    }
+    free(p.slots);
+  }
+
+  fclose(p.infp);
+
+  if (fclose(p.outfp) && !r)
+  {
+    printf("failed to write to output file\n");
+    r = -1;
+  }
+
+  // don't leave a truncated file behind
+  if (r)
+    remove(outpath);
+
+  if (total)
+    *total = p.insize;
+  if (written)
+    *written = p.written;
+
+  return r;
+}
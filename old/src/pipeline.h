@@ -0,0 +1,20 @@
+//
+// pipelined encoding of compressed filetypes, header
+//
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdint.h>
+
+// encodes inpath into outpath like the one-shot path with the zlib backend, but
+// reads, deflates (on numthreads threads, <= 0 means one per cpu), scrambles and
+// writes at the same time, block by block. compressed is COMP_YES or COMP_REVERSE,
+// key2 is 0 if the filetype only has one password. total and written receive the
+// input and output sizes (may be NULL). the level and strategy are zback_level()
+// and zback_strategy(), and for inputs over two blocks the output is the same as
+// zback_compress() with the zlib backend gives
+// returns 0 on success, -1 on failure (after printing why, the output is removed)
+extern int inti_pipeline_encode (const char *inpath, const char *outpath, int compressed, uint64_t key1, uint64_t key2, int numthreads, uint64_t *total, uint64_t *written);
+
+#endif // __PIPELINE_H__
@@ -0,0 +1,157 @@
+//
+// work-stealing thread pool
+//
+// jobs are dealt round-robin into one deque per worker, so each deque is
+// ordered from most to least expensive. a worker takes from the front of
+// its own deque, and once that is empty it steals from the back of the
+// others, i.e. the big jobs start first and the small ones fill the gaps
+//
+
+#include <stddef.h>
+#include <malloc.h>
+
+#include "threads.h"
+#include "pool.h"
+
+#define POOL_MAXTHREADS 256
+
+typedef struct
+{
+  mutex_t lock;
+  int *jobs;
+  int head, tail; // jobs[head..tail-1] are left
+}
+deque_t;
+
+typedef struct
+{
+  deque_t *deques;
+  int numthreads;
+  pooljob_t func;
+  void *ctx;
+}
+pool_t;
+
+typedef struct
+{
+  pool_t *pool;
+  int index;
+}
+worker_t;
+
+static int pop_front(deque_t *dq)
+{
+  int job = -1;
+
+  mutex_lock(&dq->lock);
+  if (dq->head < dq->tail)
+    job = dq->jobs[dq->head++];
+  mutex_unlock(&dq->lock);
+
+  return job;
+}
+
+static int pop_back(deque_t *dq)
+{
+  int job = -1;
+
+  mutex_lock(&dq->lock);
+  if (dq->head < dq->tail)
+    job = dq->jobs[--dq->tail];
+  mutex_unlock(&dq->lock);
+
+  return job;
+}
+
+static void pool_worker(void *arg)
+{
+  worker_t *w = arg;
+  pool_t *pool = w->pool;
+  int i, job;
+
+  for (;;)
+  {
+    job = pop_front(&pool->deques[w->index]);
+
+    // own deque is empty, try everyone else
+    for (i=1; job < 0 && i<pool->numthreads; i++)
+      job = pop_back(&pool->deques[(w->index+i) % pool->numthreads]);
+
+    // no new jobs are ever added, so all deques being empty means we're done
+    if (job < 0)
+      return;
+
+    pool->func(pool->ctx, job);
+  }
+}
+
+void pool_run(int numthreads, int numjobs, pooljob_t func, void *ctx)
+{
+  thread_t threads[POOL_MAXTHREADS];
+  worker_t workers[POOL_MAXTHREADS];
+  int started[POOL_MAXTHREADS];
+  pool_t pool;
+  int i, *jobs;
+
+  if (numthreads <= 0)
+    numthreads = cpu_count();
+  if (numthreads > POOL_MAXTHREADS)
+    numthreads = POOL_MAXTHREADS;
+  if (numthreads > numjobs)
+    numthreads = numjobs;
+
+  jobs = malloc(sizeof(int)*numjobs);
+  pool.deques = malloc(sizeof(deque_t)*numthreads);
+
+  if (numthreads <= 1 || !jobs || !pool.deques)
+  {
+    for (i=0; i<numjobs; i++)
+      func(ctx, i);
+
+    free(jobs);
+    free(pool.deques);
+    return;
+  }
+
+  pool.numthreads = numthreads;
+  pool.func = func;
+  pool.ctx = ctx;
+
+  // deque i owns jobs i, i+n, i+2n... stored contiguously
+  for (i=0; i<numthreads; i++)
+  {
+    mutex_init(&pool.deques[i].lock);
+    pool.deques[i].jobs = jobs + (numjobs/numthreads)*i + (i < numjobs%numthreads ? i : numjobs%numthreads);
+    pool.deques[i].head = pool.deques[i].tail = 0;
+  }
+
+  for (i=0; i<numjobs; i++)
+  {
+    deque_t *dq = &pool.deques[i % numthreads];
+    dq->jobs[dq->tail++] = i;
+  }
+
+  for (i=1; i<numthreads; i++)
+  {
+    workers[i].pool = &pool;
+    workers[i].index = i;
+    started[i] = !thread_start(&threads[i], pool_worker, &workers[i]);
+  }
+
+  // the calling thread is worker 0, jobs of workers that failed to start get stolen
+  workers[0].pool = &pool;
+  workers[0].index = 0;
+  pool_worker(&workers[0]);
+
+  for (i=1; i<numthreads; i++)
+  {
+    if (started[i])
+      thread_join(&threads[i]);
+  }
+
+  for (i=0; i<numthreads; i++)
+    mutex_destroy(&pool.deques[i].lock);
+
+  free(jobs);
+  free(pool.deques);
+}
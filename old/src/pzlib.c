@@ -0,0 +1,224 @@
+//
+// parallel zlib compression
+//
+// every block is raw-deflated on its own, primed with the 32 KB of input in
+// front of it as preset dictionary so matches can still reach back across the
+// block boundary. all but the last block end with a sync flush, which leaves
+// them byte-aligned, so the pieces can simply be concatenated between a zlib
+// header and the Adler-32 of the whole input (combined from per-block sums)
+//
+
+#include <stddef.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "pool.h"
+#include "pzlib.h"
+
+typedef struct
+{
+  const Bytef *source;
+  uLong sourcelen;
+  int level, strategy;
+  int numblocks;
+
+  Bytef **out;     // compressed data of each block
+  uLong *outlen;
+  uLong *adler;    // adler32 of each block's input
+  int *result;     // zlib return code of each block
+}
+pzjob_t;
+
+uLong pz_blockBound (uLong len)
+{
+  // raw deflate bound plus room for the empty stored block of a sync flush
+  return compressBound(len) + 16;
+}
+
+uLong pz_compressBound (uLong sourcelen)
+{
+  return compressBound(sourcelen) + (sourcelen/PZ_BLOCKSIZE + 1)*16;
+}
+
+unsigned int pz_header (int level, int strategy)
+{
+  unsigned int header, flevel;
+
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+
+  // deflate with 32K window, FLEVEL the same way deflate() picks it
+  flevel = (level < 2 || strategy >= Z_HUFFMAN_ONLY) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+  header = (0x78 << 8) | (flevel << 6);
+  header += 31 - header % 31;
+
+  return header;
+}
+
+int pz_deflate_block (Bytef *dest, uLong *destlen, const Bytef *source, uLong len, uLong dictlen, int level, int strategy, int last)
+{
+  z_stream zs;
+  int r;
+
+  memset(&zs, 0, sizeof(zs));
+  r = deflateInit2(&zs, level, Z_DEFLATED, -15, 8, strategy);
+  if (r != Z_OK)
+    return r;
+
+  if (dictlen)
+    deflateSetDictionary(&zs, source-dictlen, dictlen);
+
+  zs.next_in = (Bytef*)source;
+  zs.avail_in = len;
+  zs.next_out = dest;
+  zs.avail_out = *destlen;
+
+  r = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+  if ((last && r != Z_STREAM_END) || (!last && (r != Z_OK || zs.avail_in)))
+    r = (r == Z_OK || r == Z_STREAM_END) ? Z_BUF_ERROR : r;
+  else
+    r = Z_OK;
+
+  *destlen = zs.total_out;
+  deflateEnd(&zs);
+
+  return r;
+}
+
+static void pz_block (void *ctx, int i)
+{
+  pzjob_t *pz = ctx;
+  uLong start, len;
+
+  start = (uLong)i*PZ_BLOCKSIZE;
+  len = (pz->sourcelen - start < PZ_BLOCKSIZE) ? pz->sourcelen - start : PZ_BLOCKSIZE;
+
+  pz->adler[i] = adler32(adler32(0, NULL, 0), pz->source+start, len);
+
+  pz->outlen[i] = pz_blockBound(len);
+  pz->out[i] = malloc(pz->outlen[i]);
+  if (!pz->out[i])
+  {
+    pz->result[i] = Z_MEM_ERROR;
+    return;
+  }
+
+  pz->result[i] = pz_deflate_block(pz->out[i], &pz->outlen[i], pz->source+start, len, (start < PZ_DICTSIZE) ? start : PZ_DICTSIZE,
+                                   pz->level, pz->strategy, i == pz->numblocks-1);
+}
+
+// compress2() with a strategy
+static int compress_single (Bytef *dest, uLongf *destlen, const Bytef *source, uLong sourcelen, int level, int strategy)
+{
+  z_stream zs;
+  int r;
+
+  if (strategy == Z_DEFAULT_STRATEGY)
+    return compress2(dest, destlen, source, sourcelen, level);
+
+  memset(&zs, 0, sizeof(zs));
+  r = deflateInit2(&zs, level, Z_DEFLATED, 15, 8, strategy);
+  if (r != Z_OK)
+    return r;
+
+  zs.next_in = (Bytef*)source;
+  zs.avail_in = sourcelen;
+  zs.next_out = dest;
+  zs.avail_out = *destlen;
+
+  r = deflate(&zs, Z_FINISH);
+  *destlen = zs.total_out;
+  deflateEnd(&zs);
+
+  return (r == Z_STREAM_END) ? Z_OK : (r == Z_OK) ? Z_BUF_ERROR : r;
+}
+
+int pz_compress2 (Bytef *dest, uLongf *destlen, const Bytef *source, uLong sourcelen, int level, int strategy, int numthreads)
+{
+  pzjob_t pz;
+  uLong pos, adler;
+  unsigned int header;
+  int i, r;
+
+  if (sourcelen <= 2*PZ_BLOCKSIZE || numthreads == 1)
+    return compress_single(dest, destlen, source, sourcelen, level, strategy);
+
+  memset(&pz, 0, sizeof(pz));
+  pz.source = source;
+  pz.sourcelen = sourcelen;
+  pz.level = (level == Z_DEFAULT_COMPRESSION) ? 6 : level;
+  pz.strategy = strategy;
+  pz.numblocks = (sourcelen + PZ_BLOCKSIZE-1) / PZ_BLOCKSIZE;
+
+  pz.out = calloc(pz.numblocks, sizeof(Bytef*));
+  pz.outlen = calloc(pz.numblocks, sizeof(uLong));
+  pz.adler = calloc(pz.numblocks, sizeof(uLong));
+  pz.result = calloc(pz.numblocks, sizeof(int));
+
+  r = Z_MEM_ERROR;
+  if (pz.out && pz.outlen && pz.adler && pz.result)
+  {
+    pool_run(numthreads, pz.numblocks, pz_block, &pz);
+
+    r = Z_OK;
+    for (i=0; i<pz.numblocks && r == Z_OK; i++)
+      r = pz.result[i];
+  }
+
+  if (r == Z_OK)
+  {
+    header = pz_header(pz.level, strategy);
+
+    pos = 0;
+    if (*destlen < 2)
+      r = Z_BUF_ERROR;
+    else
+    {
+      dest[pos++] = header >> 8;
+      dest[pos++] = header & 0xFF;
+    }
+
+    adler = adler32(0, NULL, 0);
+    for (i=0; i<pz.numblocks && r == Z_OK; i++)
+    {
+      if (pos + pz.outlen[i] > *destlen)
+      {
+        r = Z_BUF_ERROR;
+        break;
+      }
+
+      memcpy(dest+pos, pz.out[i], pz.outlen[i]);
+      pos += pz.outlen[i];
+
+      adler = adler32_combine(adler, pz.adler[i], (i == pz.numblocks-1) ? sourcelen - (uLong)i*PZ_BLOCKSIZE : PZ_BLOCKSIZE);
+    }
+
+    if (r == Z_OK && pos + 4 > *destlen)
+      r = Z_BUF_ERROR;
+
+    if (r == Z_OK)
+    {
+      // adler32 trailer, big endian
+      dest[pos++] = (adler >> 24) & 0xFF;
+      dest[pos++] = (adler >> 16) & 0xFF;
+      dest[pos++] = (adler >> 8) & 0xFF;
+      dest[pos++] = adler & 0xFF;
+
+      *destlen = pos;
+    }
+  }
+
+  if (pz.out)
+  {
+    for (i=0; i<pz.numblocks; i++)
+      free(pz.out[i]);
+  }
+
+  free(pz.out);
+  free(pz.outlen);
+  free(pz.adler);
+  free(pz.result);
+
+  return r;
+}
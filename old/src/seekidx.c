@@ -0,0 +1,275 @@
+//
+// keystream checkpoint index for random access into uncompressed filetypes
+//
+// when decoding, the key state at some offset only depends on the keys and the
+// bytes in front of it, so storing the state every interval bytes lets a slice
+// of a big file be decoded by starting at the checkpoint in front of it rather
+// than at byte 0. with one password the bytes in between only need to be
+// scanned (see inti_dec_scan), with two the second key absorbs the output of
+// the first, so they are decoded in a scratch buffer. every checkpoint also
+// has a hash of the interval in front of it, so an index isn't used for a file
+// that was edited without changing its size
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+
+#include "encdec.h"
+#include "cache.h"
+#include "seekidx.h"
+
+#define SCRATCHSIZE (64*1024)
+
+// moves a decode state over len bytes of scrambled data without keeping the output
+static int advance (inti_state_t *st, const uint8_t *data, uint64_t len)
+{
+  uint8_t *scratch;
+  size_t n;
+
+  if (!st->key2)
+  {
+    st->key1 = st->key1*inti_pow(len) + inti_dec_scan(data, len);
+    st->pos += len;
+    return 0;
+  }
+
+  scratch = malloc(SCRATCHSIZE);
+  if (!scratch)
+  {
+    printf("failed to allocate memory for decode buffer\n");
+    return -1;
+  }
+
+  while (len)
+  {
+    n = (len < SCRATCHSIZE) ? len : SCRATCHSIZE;
+
+    memcpy(scratch, data, n);
+    inti_state_update(st, scratch, n);
+
+    data += n;
+    len -= n;
+  }
+
+  free(scratch);
+  return 0;
+}
+
+int inti_index_build (seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip, uint64_t key1, uint64_t key2, uint32_t interval)
+{
+  inti_state_t st;
+  uint64_t datasize;
+  uint32_t i;
+
+  memset(idx, 0, sizeof(*idx));
+
+  if (!interval || filesize < (uint64_t)headerskip)
+  {
+    printf("bad index interval or file too short\n");
+    return -1;
+  }
+
+  datasize = filesize - headerskip;
+
+  idx->interval = interval;
+  idx->headerskip = headerskip;
+  idx->filesize = filesize;
+  idx->count = datasize/interval + 1;
+
+  idx->points = malloc(sizeof(seekpoint_t)*idx->count);
+  if (!idx->points)
+  {
+    printf("failed to allocate memory for %u index entries\n", idx->count);
+    return -1;
+  }
+
+  inti_state_init(&st, ENCDEC_MODE_DEC, key1, key2);
+
+  for (i=0; i<idx->count; i++)
+  {
+    idx->points[i].key1 = st.key1;
+    idx->points[i].key2 = st.key2;
+    idx->points[i].check = i ? cache_hash(file + headerskip + (uint64_t)(i-1)*interval, interval, 0) : 0;
+
+    if (i+1 < idx->count && advance(&st, file + headerskip + (uint64_t)i*interval, interval))
+    {
+      inti_index_free(idx);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int inti_index_save (const seekidx_t *idx, const char *path)
+{
+  FILE *fp;
+  int failed;
+
+  fp = fopen(path, "wb");
+  if (!fp)
+  {
+    printf("failed to open index file '%s' for writing\n", path);
+    return -1;
+  }
+
+  // native byte order, like the length headers of the game files
+  failed = fwrite(SEEKIDX_MAGIC, 1, 8, fp) != 8 ||
+           fwrite(&idx->interval, sizeof(uint32_t), 1, fp) != 1 ||
+           fwrite(&idx->headerskip, sizeof(uint32_t), 1, fp) != 1 ||
+           fwrite(&idx->filesize, sizeof(uint64_t), 1, fp) != 1 ||
+           fwrite(&idx->count, sizeof(uint32_t), 1, fp) != 1 ||
+           fwrite(idx->points, sizeof(seekpoint_t), idx->count, fp) != idx->count;
+
+  if (fclose(fp))
+    failed = 1;
+
+  if (failed)
+  {
+    printf("failed to write index file '%s'\n", path);
+    remove(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+int inti_index_load (seekidx_t *idx, const char *path)
+{
+  FILE *fp;
+  char magic[8];
+
+  memset(idx, 0, sizeof(*idx));
+
+  fp = fopen(path, "rb");
+  if (!fp)
+    return -1; // no index is not an error worth printing, callers fall back to a full decode
+
+  if (fread(magic, 1, 8, fp) != 8)
+    memset(magic, 0, 8);
+
+  if (!memcmp(magic, SEEKIDX_MAGIC_OLD, 8))
+  {
+    printf("'%s' was built by an older version without content checks, rebuild it with xi\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  if (memcmp(magic, SEEKIDX_MAGIC, 8) ||
+      fread(&idx->interval, sizeof(uint32_t), 1, fp) != 1 ||
+      fread(&idx->headerskip, sizeof(uint32_t), 1, fp) != 1 ||
+      fread(&idx->filesize, sizeof(uint64_t), 1, fp) != 1 ||
+      fread(&idx->count, sizeof(uint32_t), 1, fp) != 1 ||
+      !idx->interval || !idx->count)
+  {
+    printf("'%s' is not a valid index file\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  idx->points = malloc(sizeof(seekpoint_t)*idx->count);
+  if (!idx->points || fread(idx->points, sizeof(seekpoint_t), idx->count, fp) != idx->count)
+  {
+    printf("failed to read index file '%s'\n", path);
+    fclose(fp);
+    inti_index_free(idx);
+    return -1;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+void inti_index_free (seekidx_t *idx)
+{
+  free(idx->points);
+  idx->points = NULL;
+  idx->count = 0;
+}
+
+int inti_index_check (const seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip, uint64_t key1, uint64_t key2, uint64_t offset)
+{
+  uint64_t point, i;
+
+  if (idx->filesize != filesize || idx->headerskip != (uint32_t)headerskip ||
+      idx->count != (filesize - headerskip)/idx->interval + 1)
+  {
+    printf("index doesn't match the file (size or header changed?)\n");
+    return -1;
+  }
+
+  if (idx->points[0].key1 != key1 || idx->points[0].key2 != key2)
+  {
+    printf("index was built with a different filetype or steamid\n");
+    return -1;
+  }
+
+  // the intervals a decode at offset would skip over
+  point = (offset > (uint64_t)headerskip) ? (offset - headerskip)/idx->interval : 0;
+  if (point >= idx->count)
+    point = idx->count-1;
+
+  for (i=1; i<=point; i++)
+  {
+    if (idx->points[i].check != cache_hash(file + headerskip + (i-1)*idx->interval, idx->interval, 0))
+    {
+      printf("index doesn't match the file (content changed in bytes %llu..%llu)\n",
+             (unsigned long long)(headerskip + (i-1)*idx->interval), (unsigned long long)(headerskip + i*idx->interval - 1));
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int inti_index_decode (const seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip,
+                       uint64_t key1, uint64_t key2, uint64_t offset, size_t len, uint8_t *out)
+{
+  inti_state_t st;
+  uint64_t start, point;
+  size_t n;
+
+  if (offset > filesize || len > filesize - offset || filesize < (uint64_t)headerskip)
+  {
+    printf("range %llu+%llu is outside of the file\n", (unsigned long long)offset, (unsigned long long)len);
+    return -1;
+  }
+
+  // the header is stored as is
+  if (offset < (uint64_t)headerskip)
+  {
+    n = (headerskip - offset < len) ? headerskip - offset : len;
+    memcpy(out, file + offset, n);
+
+    offset += n;
+    len -= n;
+    out += n;
+  }
+
+  if (!len)
+    return 0;
+
+  start = offset - headerskip; // in scrambled data
+  inti_state_init(&st, ENCDEC_MODE_DEC, key1, key2);
+
+  if (idx)
+  {
+    point = start/idx->interval;
+    if (point >= idx->count)
+      point = idx->count-1;
+
+    st.key1 = idx->points[point].key1;
+    st.key2 = idx->points[point].key2;
+    st.pos = point*idx->interval;
+  }
+
+  if (advance(&st, file + headerskip + st.pos, start - st.pos))
+    return -1;
+
+  memcpy(out, file + offset, len);
+  inti_state_update(&st, out, len);
+
+  return 0;
+}
@@ -0,0 +1,51 @@
+//
+// keystream checkpoint index for random access into uncompressed filetypes, header
+//
+
+#ifndef __SEEKIDX_H__
+#define __SEEKIDX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SEEKIDX_MAGIC "INTIIDX2"
+#define SEEKIDX_MAGIC_OLD "INTIIDX1" // without content checks
+#define SEEKIDX_INTERVAL (64*1024) // default distance between checkpoints
+
+typedef struct
+{
+  uint64_t key1;
+  uint64_t key2;
+  uint64_t check; // XXH64 of the interval of scrambled data in front of the point, 0 for point 0
+}
+seekpoint_t;
+
+typedef struct
+{
+  uint32_t interval;   // bytes of scrambled data between checkpoints
+  uint32_t headerskip; // unscrambled bytes at the start of the file
+  uint64_t filesize;   // size of the file the index was built for
+  uint32_t count;
+  seekpoint_t *points; // point i is the decode state at scrambled data offset i*interval
+}
+seekidx_t;
+
+// all functions return 0 on success, -1 on failure (after printing why)
+
+// builds the index of a scrambled COMP_NO file (header included, as on disk)
+extern int inti_index_build (seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip, uint64_t key1, uint64_t key2, uint32_t interval);
+extern int inti_index_save (const seekidx_t *idx, const char *path);
+extern int inti_index_load (seekidx_t *idx, const char *path);
+extern void inti_index_free (seekidx_t *idx);
+
+// checks that a loaded index belongs to this file and these keys, and that the
+// data in front of the checkpoint a decode at offset starts from is unchanged.
+// that hashes the file up to offset, still much faster than descrambling it
+extern int inti_index_check (const seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip, uint64_t key1, uint64_t key2, uint64_t offset);
+
+// decodes file bytes [offset, offset+len) into out, starting at the nearest checkpoint
+// in front of offset. idx may be NULL, then decoding starts at the beginning of the file
+extern int inti_index_decode (const seekidx_t *idx, const uint8_t *file, uint64_t filesize, int headerskip,
+                              uint64_t key1, uint64_t key2, uint64_t offset, size_t len, uint8_t *out);
+
+#endif // __SEEKIDX_H__
@@ -0,0 +1,366 @@
+//
+// steamid recovery for saves whose passwords end in the steamid
+//
+// the passwords are "<password><id in hex>", so there are only 2^32 key pairs.
+// the id space is cut into 65536 pool jobs that share the upper 16 bits, i.e.
+// the same password prefix. inti_keygen() is linear in the characters, so
+// with the prefix key K and the last four hex digits c1..c4
+//
+//   key = K*141^4 + c1*141^4 + c2*141^3 + c3*141^2 + c4*141
+//
+// and every candidate key costs four table lookups and adds instead of a full
+// keygen. each candidate then only decodes as many body bytes as it takes to
+// rule it out: one or two against known plaintext, otherwise a short sample
+// that has to be far less random than wrongly decoded data would be
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+
+#include "encdec.h"
+#include "threads.h"
+#include "pool.h"
+#include "steamid.h"
+
+#define JOBBITS 16
+#define NUMJOBS (1 << (32-JOBBITS))
+#define QUICKBYTES 64 // sample for the first check without known plaintext
+#define QUICKREPEATS 8 // ... in which some byte value must show up this often (random data: 0.25 times)
+#define QUICKCHUNK 16 // the sample is decoded in chunks, lanes that fall behind are dropped after each
+#define LANES 16 // candidates checked together, one per value of the last hex digit
+
+typedef struct
+{
+  const uint8_t *body;
+  size_t len;
+  const char *password1, *password2;
+  const uint8_t *known;
+  size_t knownlen;
+
+  uint64_t tail[4][16]; // hex digit n at position i of the last four, times 141^(4-i)
+  uint64_t pow4;        // 141^4
+
+  steamid_hit_t hits[STEAMID_MAXHITS];
+  int numhits;
+  mutex_t lock;
+}
+search_t;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+// repeats the most common byte value needs after each chunk of a full sample to stay in.
+// a value that is 1/8 of the data shows up twice per chunk, so these are a chunk behind
+// that pace; random data passes them 37%, 7% and 1% of the time, which cuts the bytes
+// decoded per candidate from 64 to about 23
+static const int quickpace[QUICKBYTES/QUICKCHUNK] = { 2, 3, 4, QUICKREPEATS };
+
+// per mille of the most common byte value in the first STEAMID_SAMPLE decoded bytes
+static int score (search_t *s, uint64_t key1, uint64_t key2)
+{
+  uint8_t sample[STEAMID_SAMPLE];
+  int counts[256], best;
+  inti_state_t st;
+  size_t n, i;
+
+  n = (s->len < STEAMID_SAMPLE) ? s->len : STEAMID_SAMPLE;
+  if (!n)
+    return 0;
+
+  memcpy(sample, s->body, n);
+  inti_state_init(&st, ENCDEC_MODE_DEC, key1, key2);
+  inti_state_update(&st, sample, n);
+
+  memset(counts, 0, sizeof(counts));
+  best = 0;
+  for (i=0; i<n; i++)
+  {
+    if (++counts[sample[i]] > best)
+      best = counts[sample[i]];
+  }
+
+  return (int)(best*1000/n);
+}
+
+// checks key pairs against known plaintext, one by one so most stop after the first byte
+static int known_match (search_t *s, uint64_t k1, uint64_t k2)
+{
+  const uint8_t *c = s->body;
+  uint8_t m1, p;
+  size_t j;
+
+  for (j=0; j<s->knownlen; j++)
+  {
+    m1 = c[j] ^ (k1 >> (j&0x1F));
+    p = s->password2 ? m1 ^ (k2 >> (j&0x1F)) : m1;
+
+    if (p != s->known[j])
+      return 0;
+
+    k1 = (k1 + c[j])*INTI_CONST1;
+    k2 = (k2 + m1)*INTI_CONST1;
+  }
+
+  return 1;
+}
+
+// without known plaintext the LANES key pairs decode the sample in lockstep (the same
+// decode as inti_encdec2(), byte by byte), which keeps independent multiply chains in
+// flight and lets the compiler vectorize the lanes. after every chunk the lanes that
+// fell behind quickpace are dropped and the rest moved down, so later chunks only
+// decode the few that still look like save data
+static void sample_check (search_t *s, const uint64_t *key1, const uint64_t *key2, int *pass)
+{
+  uint64_t k1[LANES], k2[LANES], mask2;
+  uint8_t decoded[QUICKBYTES][LANES], m1, c;
+  int lane[LANES], counts[256], best, need, live, l, i;
+  size_t j, start, end, n;
+
+  n = (s->len < QUICKBYTES) ? s->len : QUICKBYTES;
+  mask2 = s->password2 ? ~0ULL : 0;
+
+  memcpy(k1, key1, sizeof(k1));
+  memcpy(k2, key2, sizeof(k2));
+
+  for (l=0; l<LANES; l++)
+  {
+    lane[l] = l;
+    pass[l] = 0;
+  }
+
+  memset(counts, 0, sizeof(counts));
+  live = LANES;
+
+  // short bodies are checked in one go
+  for (start=0; start<n && live; start=end)
+  {
+    end = (n < QUICKBYTES) ? n : start + QUICKCHUNK;
+
+    for (j=start; j<end; j++)
+    {
+      c = s->body[j];
+
+      for (l=0; l<live; l++)
+      {
+        m1 = c ^ (k1[l] >> (j&0x1F));
+        decoded[j][l] = m1 ^ ((k2[l] & mask2) >> (j&0x1F));
+
+        k1[l] = (k1[l] + c)*INTI_CONST1;
+        k2[l] = (k2[l] + m1)*INTI_CONST1;
+      }
+    }
+
+    if (n < QUICKBYTES)
+      need = (int)(n/8) + 2;
+    else
+      need = quickpace[end/QUICKCHUNK - 1];
+
+    for (l=0, i=0; l<live; l++)
+    {
+      best = 0;
+      for (j=0; j<end; j++)
+      {
+        if (++counts[decoded[j][l]] > best)
+          best = counts[decoded[j][l]];
+      }
+
+      for (j=0; j<end; j++)
+        counts[decoded[j][l]] = 0;
+
+      if (best < need)
+        continue;
+
+      if (end == n)
+        pass[lane[l]] = 1;
+      else if (i != l)
+      {
+        k1[i] = k1[l];
+        k2[i] = k2[l];
+        lane[i] = lane[l];
+        for (j=0; j<end; j++)
+          decoded[j][i] = decoded[j][l];
+      }
+
+      i++;
+    }
+
+    live = i;
+  }
+}
+
+static void addhit (search_t *s, uint32_t id, uint64_t key1, uint64_t key2)
+{
+  steamid_hit_t hit;
+  int i, worst;
+
+  hit.id = id;
+  hit.score = score(s, key1, key2);
+
+  // without known plaintext, the whole sample has to be far from random as well
+  if (!s->known && hit.score < 1000/32)
+    return;
+
+  mutex_lock(&s->lock);
+
+  if (s->numhits < STEAMID_MAXHITS)
+    s->hits[s->numhits++] = hit;
+  else
+  {
+    worst = 0;
+    for (i=1; i<s->numhits; i++)
+    {
+      if (s->hits[i].score < s->hits[worst].score)
+        worst = i;
+    }
+
+    if (hit.score > s->hits[worst].score)
+      s->hits[worst] = hit;
+  }
+
+  mutex_unlock(&s->lock);
+}
+
+static void check_lanes (search_t *s, uint32_t firstid, const uint64_t *k1, const uint64_t *k2)
+{
+  int pass[LANES], l;
+
+  if (s->known)
+  {
+    for (l=0; l<LANES; l++)
+      pass[l] = known_match(s, k1[l], k2[l]);
+  }
+  else
+    sample_check(s, k1, k2, pass);
+
+  for (l=0; l<LANES; l++)
+  {
+    if (pass[l])
+      addhit(s, firstid + l, k1[l], k2[l]);
+  }
+}
+
+static void search_job (void *ctx, int job)
+{
+  search_t *s = ctx;
+  uint64_t base1, base2, p1, p2, k1[LANES], k2[LANES];
+  uint32_t high, id;
+  char pwdbuf[64];
+  int a, b, c, d;
+
+  high = (uint32_t)job << JOBBITS;
+
+  for (d=0; d<LANES; d++)
+    k2[d] = 0;
+
+  // ids below 0x10000 have less than five hex digits, just do them one by one
+  if (!job)
+  {
+    for (id=0; id < (1u << JOBBITS); id += LANES)
+    {
+      for (d=0; d<LANES; d++)
+      {
+        snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", s->password1, id + d);
+        k1[d] = inti_keygen(pwdbuf);
+
+        if (s->password2)
+        {
+          snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", s->password2, id + d);
+          k2[d] = inti_keygen(pwdbuf);
+        }
+      }
+
+      check_lanes(s, id, k1, k2);
+    }
+
+    return;
+  }
+
+  snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", s->password1, job);
+  base1 = inti_keygen(pwdbuf)*s->pow4;
+
+  base2 = 0;
+  if (s->password2)
+  {
+    snprintf(pwdbuf, sizeof(pwdbuf), "%s%x", s->password2, job);
+    base2 = inti_keygen(pwdbuf)*s->pow4;
+  }
+
+  for (a=0; a<16; a++)
+  {
+    for (b=0; b<16; b++)
+    {
+      for (c=0; c<16; c++)
+      {
+        p1 = base1 + s->tail[0][a] + s->tail[1][b] + s->tail[2][c];
+        p2 = base2 + s->tail[0][a] + s->tail[1][b] + s->tail[2][c];
+
+        for (d=0; d<LANES; d++)
+        {
+          k1[d] = p1 + s->tail[3][d];
+          if (s->password2)
+            k2[d] = p2 + s->tail[3][d];
+        }
+
+        check_lanes(s, high | (a << 12) | (b << 8) | (c << 4), k1, k2);
+      }
+    }
+  }
+}
+
+static int cmphits (const void *a, const void *b)
+{
+  const steamid_hit_t *ha = a, *hb = b;
+
+  if (ha->score != hb->score)
+    return ha->score < hb->score ? 1 : -1;
+
+  return (ha->id > hb->id) - (ha->id < hb->id);
+}
+
+int inti_find_steamid (const uint8_t *body, size_t len, const char *password1, const char *password2,
+                       const uint8_t *known, size_t knownlen, int numthreads, steamid_hit_t *hits)
+{
+  search_t *s;
+  int i, n, numhits;
+
+  if (!len || (known && (!knownlen || knownlen > len)))
+  {
+    printf("nothing to search with (empty body or bad known plaintext)\n");
+    return -1;
+  }
+
+  s = calloc(1, sizeof(search_t));
+  if (!s)
+  {
+    printf("failed to allocate memory for the search\n");
+    return -1;
+  }
+
+  s->body = body;
+  s->len = len;
+  s->password1 = password1;
+  s->password2 = password2;
+  s->known = known;
+  s->knownlen = knownlen;
+  s->pow4 = inti_pow(4);
+
+  for (i=0; i<4; i++)
+  {
+    for (n=0; n<16; n++)
+      s->tail[i][n] = (uint64_t)hexdigits[n]*inti_pow(4-i);
+  }
+
+  mutex_init(&s->lock);
+  pool_run(numthreads, NUMJOBS, search_job, s);
+  mutex_destroy(&s->lock);
+
+  qsort(s->hits, s->numhits, sizeof(steamid_hit_t), cmphits);
+  memcpy(hits, s->hits, sizeof(steamid_hit_t)*s->numhits);
+
+  numhits = s->numhits;
+  free(s);
+
+  return numhits;
+}
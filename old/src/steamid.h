@@ -0,0 +1,31 @@
+//
+// steamid recovery for saves whose passwords end in the steamid, header
+//
+
+#ifndef __STEAMID_H__
+#define __STEAMID_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STEAMID_BASE 76561197960265728ULL // steamid64 of account id 0, the passwords use the low 32 bits
+#define STEAMID_MAXHITS 64
+#define STEAMID_SAMPLE 4096 // body bytes the plausibility check looks at
+
+typedef struct
+{
+  uint32_t id;  // low 32 bits of the steamid (the account id)
+  int score;    // how plausible the decoded body looks, higher is better
+}
+steamid_hit_t;
+
+// tries every 32-bit id on numthreads threads (<= 0 means one per cpu): the passwords are
+// password1/password2 followed by the id in lowercase hex, body is the scrambled data
+// after the unscrambled header. with known plaintext (the first knownlen decoded bytes of
+// the body, e.g. taken from another save of the same game) only exact matches are hits,
+// otherwise the decoded body has to look like save data rather than noise.
+// returns the number of hits stored in hits (best first), -1 on failure
+extern int inti_find_steamid (const uint8_t *body, size_t len, const char *password1, const char *password2,
+                              const uint8_t *known, size_t knownlen, int numthreads, steamid_hit_t *hits);
+
+#endif // __STEAMID_H__
@@ -0,0 +1,322 @@
+//
+// streaming encode/decode with bounded memory
+//
+// input is read in fixed size windows, scrambled/descrambled and run through
+// inflate/deflate as it flows by, so memory use doesn't depend on file size
+//
+
+#ifndef _WIN32
+  #define _FILE_OFFSET_BITS 64 // 64-bit ftello/fseeko on 32-bit hosts
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "encdec.h"
+#include "filetypes.h"
+#include "stream.h"
+#include "zback.h"
+
+typedef uint8_t byte;
+
+#ifdef _WIN32
+  #define fseek64 _fseeki64
+  #define ftell64 _ftelli64
+#else
+  #define fseek64 fseeko
+  #define ftell64 ftello
+#endif
+
+typedef struct
+{
+  FILE *infp, *outfp;
+  byte *inbuf, *outbuf;
+  inti_state_t st;
+  uint64_t total; // bytes of uncompressed data seen
+  uint64_t written;
+}
+stream_t;
+
+static int write_all (stream_t *s, byte *buf, size_t len)
+{
+  if (len && fwrite(buf, 1, len, s->outfp) != len)
+  {
+    printf("failed to write to output file\n");
+    return -1;
+  }
+
+  s->written += len;
+  return 0;
+}
+
+// no compression, optionally an unscrambled header
+static int stream_plain (stream_t *s, int headerskip)
+{
+  size_t n;
+
+  if (headerskip)
+  {
+    n = fread(s->inbuf, 1, headerskip, s->infp);
+    if (write_all(s, s->inbuf, n))
+      return -1;
+  }
+
+  while ((n = fread(s->inbuf, 1, STREAM_WINDOW, s->infp)) > 0)
+  {
+    inti_state_update(&s->st, s->inbuf, n);
+    s->total += n;
+
+    if (write_all(s, s->inbuf, n))
+      return -1;
+  }
+
+  return 0;
+}
+
+// decoding compressed types, descramble_first is set for COMP_YES
+static int stream_inflate (stream_t *s, int descramble_first)
+{
+  z_stream zs;
+  byte hdr[sizeof(uint32_t)];
+  uint32_t unzsize;
+  size_t n;
+  int r;
+
+  if (fread(hdr, 1, sizeof(hdr), s->infp) != sizeof(hdr))
+  {
+    printf("input file is too short\n");
+    return -1;
+  }
+
+  if (descramble_first)
+    inti_state_update(&s->st, hdr, sizeof(hdr));
+
+  // first 4 bytes is uncompressed length, only used as a sanity check here
+  memcpy(&unzsize, hdr, sizeof(uint32_t));
+
+  memset(&zs, 0, sizeof(zs));
+  r = inflateInit(&zs);
+  if (r != Z_OK)
+  {
+    printf("zlib init failed, error code %i\n", r);
+    return -1;
+  }
+
+  r = Z_OK;
+  while (r != Z_STREAM_END && (n = fread(s->inbuf, 1, STREAM_WINDOW, s->infp)) > 0)
+  {
+    if (descramble_first)
+      inti_state_update(&s->st, s->inbuf, n);
+
+    zs.next_in = s->inbuf;
+    zs.avail_in = n;
+
+    do
+    {
+      zs.next_out = s->outbuf;
+      zs.avail_out = STREAM_WINDOW;
+
+      // Z_BUF_ERROR only means no progress was possible, e.g. when the last
+      // call filled outbuf exactly and used up the input; read on
+      r = inflate(&zs, Z_NO_FLUSH);
+      if (r == Z_BUF_ERROR && (zs.avail_in == 0 || zs.avail_out == 0))
+        r = Z_OK;
+      if (r != Z_OK && r != Z_STREAM_END)
+      {
+        printf("zlib decompression failed, error code %i\n", r);
+        inflateEnd(&zs);
+        return -1;
+      }
+
+      n = STREAM_WINDOW - zs.avail_out;
+      if (!descramble_first)
+        inti_state_update(&s->st, s->outbuf, n);
+      s->total += n;
+
+      if (write_all(s, s->outbuf, n))
+      {
+        inflateEnd(&zs);
+        return -1;
+      }
+    }
+    while (zs.avail_out == 0 && r != Z_STREAM_END);
+  }
+
+  inflateEnd(&zs);
+
+  if (r != Z_STREAM_END)
+  {
+    printf("zlib decompression failed, unexpected end of data\n");
+    return -1;
+  }
+
+  if (s->total != unzsize)
+  {
+    printf("uncompressed size %llu doesn't match header (%u)\n", (unsigned long long)s->total, unzsize);
+    return -1;
+  }
+
+  return 0;
+}
+
+// encoding compressed types, scramble_after is set for COMP_YES
+static int stream_deflate (stream_t *s, int scramble_after)
+{
+  z_stream zs;
+  byte hdr[sizeof(uint32_t)];
+  uint32_t unzsize;
+  int64_t insize;
+  size_t n;
+  int r, flush, level;
+
+  // the header needs the full uncompressed length before any data is written
+  if (fseek64(s->infp, 0, SEEK_END) || (insize = ftell64(s->infp)) < 0 || fseek64(s->infp, 0, SEEK_SET))
+  {
+    printf("failed to get size of input file\n");
+    return -1;
+  }
+
+  if ((uint64_t)insize > UINT32_MAX)
+  {
+    printf("input file is too large for the 32-bit length header\n");
+    return -1;
+  }
+
+  unzsize = insize;
+  memcpy(hdr, &unzsize, sizeof(uint32_t));
+
+  if (scramble_after)
+    inti_state_update(&s->st, hdr, sizeof(hdr));
+
+  if (write_all(s, hdr, sizeof(hdr)))
+    return -1;
+
+  // same settings as the one-shot path, but stream mode is always zlib
+  level = zback_level();
+  if (level > 9)
+    level = 9;
+
+  memset(&zs, 0, sizeof(zs));
+  r = deflateInit2(&zs, level, Z_DEFLATED, 15, 8, zback_strategy());
+  if (r != Z_OK)
+  {
+    printf("zlib init failed, error code %i\n", r);
+    return -1;
+  }
+
+  do
+  {
+    n = fread(s->inbuf, 1, STREAM_WINDOW, s->infp);
+    s->total += n;
+    flush = (n < STREAM_WINDOW) ? Z_FINISH : Z_NO_FLUSH;
+
+    if (!scramble_after)
+      inti_state_update(&s->st, s->inbuf, n);
+
+    zs.next_in = s->inbuf;
+    zs.avail_in = n;
+
+    do
+    {
+      zs.next_out = s->outbuf;
+      zs.avail_out = STREAM_WINDOW;
+
+      r = deflate(&zs, flush);
+      if (r == Z_STREAM_ERROR)
+      {
+        printf("zlib compression failed, error code %i\n", r);
+        deflateEnd(&zs);
+        return -1;
+      }
+
+      n = STREAM_WINDOW - zs.avail_out;
+      if (scramble_after)
+        inti_state_update(&s->st, s->outbuf, n);
+
+      if (write_all(s, s->outbuf, n))
+      {
+        deflateEnd(&zs);
+        return -1;
+      }
+    }
+    while (zs.avail_out == 0);
+  }
+  while (flush != Z_FINISH);
+
+  deflateEnd(&zs);
+
+  if (s->total != unzsize)
+  {
+    printf("input file changed while it was being compressed\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int inti_stream_file (const char *inpath, const char *outpath, int encode, int compressed, int headerskip, uint64_t key1, uint64_t key2, uint64_t *total, uint64_t *written)
+{
+  stream_t s;
+  int r;
+
+  memset(&s, 0, sizeof(s));
+
+  s.infp = fopen(inpath, "rb");
+  if (!s.infp)
+  {
+    printf("failed to open input file '%s'\n", inpath);
+    return -1;
+  }
+
+  remove(outpath); // may be a hardlink into the conversion cache
+  s.outfp = fopen(outpath, "wb");
+  if (!s.outfp)
+  {
+    printf("failed to open output file '%s'\n", outpath);
+    fclose(s.infp);
+    return -1;
+  }
+
+  s.inbuf = malloc(STREAM_WINDOW);
+  s.outbuf = malloc(STREAM_WINDOW);
+  if (!s.inbuf || !s.outbuf)
+  {
+    printf("failed to allocate memory for stream buffers\n");
+    r = -1;
+  }
+  else
+  {
+    inti_state_init(&s.st, encode ? ENCDEC_MODE_ENC : ENCDEC_MODE_DEC, key1, key2);
+
+    if (compressed == COMP_NO)
+      r = stream_plain(&s, headerskip);
+    else if (encode)
+      r = stream_deflate(&s, compressed == COMP_YES);
+    else
+      r = stream_inflate(&s, compressed == COMP_YES);
+
+    if (total)
+      *total = s.total;
+    if (written)
+      *written = s.written;
+  }
+
+  free(s.inbuf);
+  free(s.outbuf);
+  fclose(s.infp);
+
+  if (fclose(s.outfp) && !r)
+  {
+    printf("failed to write to output file\n");
+    r = -1;
+  }
+
+  // don't leave a truncated file behind
+  if (r)
+    remove(outpath);
+
+  return r;
+}
@@ -0,0 +1,18 @@
+//
+// streaming encode/decode with bounded memory, header
+//
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+
+#define STREAM_WINDOW (256*1024)
+
+// compressed is one of COMP_*, key2 is 0 if the filetype only has one password,
+// total receives the number of uncompressed bytes and written the size of the
+// output file (both may be NULL). encoding uses zback_level()/zback_strategy()
+// returns 0 on success, -1 on failure (after printing why)
+extern int inti_stream_file (const char *inpath, const char *outpath, int encode, int compressed, int headerskip, uint64_t key1, uint64_t key2, uint64_t *total, uint64_t *written);
+
+#endif // __STREAM_H__
@@ -0,0 +1,179 @@
+//
+// portable threads
+//
+
+#include <stddef.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <time.h>
+  #include <unistd.h>
+  #include <pthread.h>
+#endif
+
+#include "threads.h"
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_trampoline(LPVOID param)
+{
+  thread_t *t = param;
+
+  t->func(t->arg);
+  return 0;
+}
+
+int thread_start(thread_t *t, threadfunc_t func, void *arg)
+{
+  t->func = func;
+  t->arg = arg;
+  t->th = CreateThread(NULL, 0, thread_trampoline, t, 0, NULL);
+
+  return t->th ? 0 : -1;
+}
+
+void thread_join(thread_t *t)
+{
+  WaitForSingleObject(t->th, INFINITE);
+  CloseHandle(t->th);
+}
+
+void mutex_init(mutex_t *m)
+{
+  InitializeCriticalSection(m);
+}
+
+void mutex_lock(mutex_t *m)
+{
+  EnterCriticalSection(m);
+}
+
+void mutex_unlock(mutex_t *m)
+{
+  LeaveCriticalSection(m);
+}
+
+void mutex_destroy(mutex_t *m)
+{
+  DeleteCriticalSection(m);
+}
+
+void cond_init(cond_t *c)
+{
+  InitializeConditionVariable(c);
+}
+
+void cond_wait(cond_t *c, mutex_t *m)
+{
+  SleepConditionVariableCS(c, m, INFINITE);
+}
+
+void cond_broadcast(cond_t *c)
+{
+  WakeAllConditionVariable(c);
+}
+
+void cond_destroy(cond_t *c)
+{
+  (void)c; // nothing to free
+}
+
+int cpu_count(void)
+{
+  SYSTEM_INFO si;
+
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+double wallclock(void)
+{
+  LARGE_INTEGER freq, count;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / freq.QuadPart;
+}
+
+#else // not _WIN32
+
+static void *thread_trampoline(void *param)
+{
+  thread_t *t = param;
+
+  t->func(t->arg);
+  return NULL;
+}
+
+int thread_start(thread_t *t, threadfunc_t func, void *arg)
+{
+  t->func = func;
+  t->arg = arg;
+
+  return pthread_create(&t->th, NULL, thread_trampoline, t) ? -1 : 0;
+}
+
+void thread_join(thread_t *t)
+{
+  pthread_join(t->th, NULL);
+}
+
+void mutex_init(mutex_t *m)
+{
+  pthread_mutex_init(m, NULL);
+}
+
+void mutex_lock(mutex_t *m)
+{
+  pthread_mutex_lock(m);
+}
+
+void mutex_unlock(mutex_t *m)
+{
+  pthread_mutex_unlock(m);
+}
+
+void mutex_destroy(mutex_t *m)
+{
+  pthread_mutex_destroy(m);
+}
+
+void cond_init(cond_t *c)
+{
+  pthread_cond_init(c, NULL);
+}
+
+void cond_wait(cond_t *c, mutex_t *m)
+{
+  pthread_cond_wait(c, m);
+}
+
+void cond_broadcast(cond_t *c)
+{
+  pthread_cond_broadcast(c);
+}
+
+void cond_destroy(cond_t *c)
+{
+  pthread_cond_destroy(c);
+}
+
+int cpu_count(void)
+{
+  long n;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+double wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+#endif // _WIN32
@@ -0,0 +1,20 @@
+//
+// maximum compression search, header
+//
+
+#ifndef __ZSEARCH_H__
+#define __ZSEARCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ZSEARCH_ZOPFLI_MAX (16*1024*1024) // zopfli is only tried on inputs up to this size
+
+// deflates source with every setup in the candidate list (zlib strategies, window and
+// memLevel sizes, an exhaustive zlib match search, libdeflate/zlib-ng/zopfli when compiled
+// in) on numthreads threads (<= 0 means one per cpu), checks every result by inflating it
+// again and keeps the smallest one. dest needs room for compressBound(sourcelen) bytes.
+// winner receives the name of the setup that won (may be NULL). returns a zlib Z_* code
+extern int zsearch_compress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int numthreads, const char **winner);
+
+#endif // __ZSEARCH_H__
@@ -0,0 +1,203 @@
+//
+// round trip checks through the library interface
+//
+// prints one line per case and returns 1 if any of them failed
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "libinti.h"
+#include "encdec.h"
+#include "filetypes.h"
+#include "stream.h"
+
+static int failures = 0;
+
+static void check (const char *name, int ok)
+{
+  printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+// an empty input encodes to a size header and an empty zlib stream. decoding
+// it gets no output buffer at all, like an empty file mapped by mmfiles.c
+static void empty_roundtrip (const char *shorthand)
+{
+  inti_cspan_t in, enc;
+  inti_span_t out, dec;
+  size_t bound, size, outlen;
+  char name[64];
+  int type, r;
+
+  type = inti_lib_filetype(shorthand);
+  snprintf(name, sizeof(name), "empty %s", shorthand);
+
+  if (type < 0 || inti_encoded_bound(type, 0, &bound))
+  {
+    check(name, 0);
+    return;
+  }
+
+  out.ptr = malloc(bound);
+  out.len = bound;
+  in.ptr = NULL;
+  in.len = 0;
+
+  r = out.ptr ? inti_encode(type, 0, in, out, &outlen) : INTI_ERR_MEMORY;
+  if (r)
+  {
+    printf("%s: encode: %s\n", name, inti_strerror(r));
+    check(name, 0);
+    free(out.ptr);
+    return;
+  }
+
+  enc.ptr = out.ptr;
+  enc.len = outlen;
+
+  r = inti_decoded_size(type, 0, enc, &size);
+  if (!r && size)
+    r = INTI_ERR_FORMAT;
+
+  if (!r)
+  {
+    dec.ptr = NULL;
+    dec.len = 0;
+    r = inti_decode(type, 0, enc, dec, &outlen);
+  }
+
+  if (r)
+    printf("%s: decode: %s\n", name, inti_strerror(r));
+  check(name, !r && !outlen);
+
+  free(out.ptr);
+}
+
+// a json2 file whose first STREAM_WINDOW compressed bytes inflate to exactly
+// two output windows, with only the end of the stream left for the next read.
+// inflate then has neither input nor output to work with and says Z_BUF_ERROR,
+// which the streamed decoder has to take as "read on"
+static void stream_window_boundary (void)
+{
+  const char *name = "stream window boundary", *inpath = "inti_test_stream.json2", *outpath = "inti_test_stream.out";
+  uint8_t *data, *z, *ref, *got;
+  size_t len, zlen, pad, n, i, reflen;
+  inti_cspan_t in;
+  inti_span_t out;
+  uint32_t seed, adler;
+  uint64_t total;
+  z_stream zs;
+  FILE *fp;
+  int ok;
+
+  len = 2*STREAM_WINDOW;
+  data = malloc(len);
+  z = malloc(len + 1024);
+  ref = malloc(len);
+  got = malloc(len);
+  if (!data || !z || !ref || !got)
+  {
+    check(name, 0);
+    free(data); free(z); free(ref); free(got);
+    return;
+  }
+
+  // noise up to n, zeros after it. n is moved until the fully flushed stream is
+  // a multiple of 5 bytes short of the window, then padded with empty stored
+  // blocks (5 bytes each) so it ends right at the window
+  n = STREAM_WINDOW - 1024;
+  seed = 1;
+  for (i=0; i<len; i++)
+  {
+    seed = seed*1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+
+  for (;;)
+  {
+    memset(&zs, 0, sizeof(zs));
+    deflateInit(&zs, 9);
+    zs.next_in = data;
+    zs.avail_in = len;
+    zs.next_out = z + 4;
+    zs.avail_out = len + 1024 - 4;
+
+    for (i=n; i<len; i++)
+      data[i] = 0;
+
+    deflate(&zs, Z_FULL_FLUSH);
+    zlen = zs.total_out;
+    deflateEnd(&zs);
+
+    if (zlen <= STREAM_WINDOW && (STREAM_WINDOW - zlen) % 5 == 0)
+      break;
+
+    // n only moves down, so the zeros of this try stay right for the next
+    n -= (zlen > STREAM_WINDOW) ? zlen - STREAM_WINDOW : 1;
+  }
+
+  for (pad=zlen; pad<STREAM_WINDOW; pad+=5)
+    memcpy(z + 4 + pad, "\x00\x00\x00\xFF\xFF", 5);
+
+  // final empty fixed block, then the adler32 of the data
+  adler = adler32(adler32(0, NULL, 0), data, len);
+  z[4 + pad] = 0x03;
+  z[5 + pad] = 0x00;
+  z[6 + pad] = adler >> 24;
+  z[7 + pad] = adler >> 16;
+  z[8 + pad] = adler >> 8;
+  z[9 + pad] = adler;
+  zlen = pad + 6;
+
+  z[0] = len; z[1] = len >> 8; z[2] = len >> 16; z[3] = len >> 24;
+
+  fp = fopen(inpath, "wb");
+  ok = fp && fwrite(z, 1, zlen + 4, fp) == zlen + 4;
+  if (fp && fclose(fp))
+    ok = 0;
+
+  // the whole-buffer decoder is the reference
+  in.ptr = z;
+  in.len = zlen + 4;
+  out.ptr = ref;
+  out.len = len;
+  if (ok && inti_decode(inti_lib_filetype("json2"), 0, in, out, &reflen))
+    ok = 0;
+
+  if (ok && inti_stream_file(inpath, outpath, 0, COMP_REVERSE, 0, inti_keygen("xN5sUeRo"), 0, &total, NULL))
+    ok = 0;
+
+  if (ok)
+  {
+    fp = fopen(outpath, "rb");
+    ok = fp && fread(got, 1, len, fp) == len && fgetc(fp) == EOF && total == len && reflen == len && !memcmp(got, ref, len);
+    if (fp)
+      fclose(fp);
+  }
+
+  check(name, ok);
+
+  remove(inpath);
+  remove(outpath);
+
+  free(data);
+  free(z);
+  free(ref);
+  free(got);
+}
+
+int main (void)
+{
+  inti_lib_init();
+
+  empty_roundtrip("bft");
+  empty_roundtrip("json2");
+  stream_window_boundary();
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,688 @@
+//
+// content-addressed conversion cache
+//
+// outputs are stored under a key made from the hash of the input's content and
+// a string with everything else that goes into the conversion, so a rebuild of
+// a whole asset tree only converts the files that changed. the hash is two
+// seeded XXH64 over the same bytes (128 bits, several GB/s), fast enough that
+// hashing an input costs much less than descrambling it, not a cryptographic
+// one: the cache is meant for a local build, not for untrusted inputs.
+//
+// entries live in <dir>/<first two hex digits>/<32 hex digits>. a hit is
+// served as a reflink (copy-on-write clone, linux filesystems that have one),
+// else a hardlink, else a copy. entries are stored read-only, so a hardlinked
+// output can't be edited in place by accident, and every output path is
+// removed before it is written, so a link into the cache is replaced rather
+// than written through. root ignores the read-only bits, so each entry also has
+// a <entry>.sum with its size and hash, checked before the entry is served; an
+// entry that no longer matches is dropped and the input converted as on a miss.
+// delete the directory to clear the cache
+//
+
+#ifndef _WIN32
+  #define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #ifdef __linux__
+    #include <sys/ioctl.h>
+    #include <linux/fs.h> // FICLONE
+  #endif
+#endif
+
+#include "threads.h"
+#include "zback.h"
+#include "cache.h"
+
+#define CACHE_VERSION "inti-cache-1" // part of every key, bump when outputs change
+#define CACHE_CHUNK (256*1024)
+
+static char *cachedir;
+static mutex_t cachelock;
+static unsigned int tmpcounter;
+
+// XXH64
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct
+{
+  uint64_t v[4];
+  uint64_t seed;
+  uint64_t total;
+  uint8_t mem[32];
+  size_t memsize;
+}
+xxh64_t;
+
+static uint64_t rotl64 (uint64_t x, int r)
+{
+  return (x << r) | (x >> (64-r));
+}
+
+static uint64_t read64 (const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v)); // little endian, like every platform the games run on
+  return v;
+}
+
+static uint32_t read32 (const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t xxround (uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = rotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static uint64_t xxmerge (uint64_t acc, uint64_t val)
+{
+  acc ^= xxround(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void xxh64_init (xxh64_t *s, uint64_t seed)
+{
+  memset(s, 0, sizeof(*s));
+  s->seed = seed;
+  s->v[0] = seed + PRIME64_1 + PRIME64_2;
+  s->v[1] = seed + PRIME64_2;
+  s->v[2] = seed;
+  s->v[3] = seed - PRIME64_1;
+}
+
+static void xxh64_stripes (xxh64_t *s, const uint8_t *p, size_t len)
+{
+  uint64_t v0 = s->v[0], v1 = s->v[1], v2 = s->v[2], v3 = s->v[3];
+
+  for (; len >= 32; p += 32, len -= 32)
+  {
+    v0 = xxround(v0, read64(p));
+    v1 = xxround(v1, read64(p+8));
+    v2 = xxround(v2, read64(p+16));
+    v3 = xxround(v3, read64(p+24));
+  }
+
+  s->v[0] = v0; s->v[1] = v1; s->v[2] = v2; s->v[3] = v3;
+}
+
+static void xxh64_update (xxh64_t *s, const uint8_t *p, size_t len)
+{
+  size_t n;
+
+  s->total += len;
+
+  if (s->memsize)
+  {
+    n = 32 - s->memsize;
+    if (n > len)
+      n = len;
+
+    memcpy(s->mem + s->memsize, p, n);
+    s->memsize += n;
+    p += n;
+    len -= n;
+
+    if (s->memsize < 32)
+      return;
+
+    xxh64_stripes(s, s->mem, 32);
+    s->memsize = 0;
+  }
+
+  n = len & ~(size_t)31;
+  xxh64_stripes(s, p, n);
+
+  memcpy(s->mem, p+n, len-n);
+  s->memsize = len-n;
+}
+
+static uint64_t xxh64_digest (const xxh64_t *s)
+{
+  const uint8_t *p = s->mem;
+  size_t len = s->memsize;
+  uint64_t h;
+
+  if (s->total >= 32)
+  {
+    h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+    h = xxmerge(h, s->v[0]);
+    h = xxmerge(h, s->v[1]);
+    h = xxmerge(h, s->v[2]);
+    h = xxmerge(h, s->v[3]);
+  }
+  else
+    h = s->seed + PRIME64_5;
+
+  h += s->total;
+
+  for (; len >= 8; p += 8, len -= 8)
+  {
+    h ^= xxround(0, read64(p));
+    h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (len >= 4)
+  {
+    h ^= (uint64_t)read32(p) * PRIME64_1;
+    h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+    len -= 4;
+  }
+
+  for (; len; p++, len--)
+  {
+    h ^= *p * PRIME64_5;
+    h = rotl64(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t cache_hash (const void *data, size_t len, uint64_t seed)
+{
+  xxh64_t s;
+
+  xxh64_init(&s, seed);
+  xxh64_update(&s, data, len);
+  return xxh64_digest(&s);
+}
+
+// two halves with different seeds, the settings go in front of the content
+typedef struct
+{
+  xxh64_t half[2];
+}
+keyhash_t;
+
+static void keyhash_init (keyhash_t *k, const char *settings)
+{
+  xxh64_init(&k->half[0], 0);
+  xxh64_init(&k->half[1], PRIME64_3);
+
+  xxh64_update(&k->half[0], (const uint8_t *)CACHE_VERSION, sizeof(CACHE_VERSION));
+  xxh64_update(&k->half[1], (const uint8_t *)CACHE_VERSION, sizeof(CACHE_VERSION));
+  xxh64_update(&k->half[0], (const uint8_t *)settings, strlen(settings)+1);
+  xxh64_update(&k->half[1], (const uint8_t *)settings, strlen(settings)+1);
+}
+
+static void keyhash_update (keyhash_t *k, const void *data, size_t len)
+{
+  xxh64_update(&k->half[0], data, len);
+  xxh64_update(&k->half[1], data, len);
+}
+
+static void keyhash_final (keyhash_t *k, cachekey_t *key)
+{
+  key->h[0] = xxh64_digest(&k->half[0]);
+  key->h[1] = xxh64_digest(&k->half[1]);
+}
+
+void cache_key_buffer (cachekey_t *key, const void *data, size_t len, const char *settings)
+{
+  keyhash_t k;
+
+  keyhash_init(&k, settings);
+  keyhash_update(&k, data, len);
+  keyhash_final(&k, key);
+}
+
+// size may be NULL
+static int hashfile (cachekey_t *key, uint64_t *size, const char *path, const char *settings)
+{
+  keyhash_t k;
+  uint8_t *buf;
+  uint64_t total;
+  size_t n;
+  FILE *fp;
+  int r;
+
+  fp = fopen(path, "rb");
+  if (!fp)
+    return -1;
+
+  buf = malloc(CACHE_CHUNK);
+  if (!buf)
+  {
+    fclose(fp);
+    return -1;
+  }
+
+  total = 0;
+  keyhash_init(&k, settings);
+  while ((n = fread(buf, 1, CACHE_CHUNK, fp)) > 0)
+  {
+    keyhash_update(&k, buf, n);
+    total += n;
+  }
+  keyhash_final(&k, key);
+
+  r = ferror(fp) ? -1 : 0;
+
+  free(buf);
+  fclose(fp);
+
+  if (size)
+    *size = total;
+
+  return r;
+}
+
+int cache_key_file (cachekey_t *key, const char *path, const char *settings)
+{
+  return hashfile(key, NULL, path, settings);
+}
+
+const char *cache_deflate_settings (char *buf, size_t size)
+{
+  snprintf(buf, size, "%s %i %i", zback_name(zback_current()), zback_level(), zback_strategy());
+  return buf;
+}
+
+const char *cache_conv_settings (char *buf, size_t size, int encode, int streamed, int compressed, int headerskip, uint64_t key1, uint64_t key2)
+{
+  char deflate[64];
+
+  // decoding gives the same bytes whichever way it's done
+  if (encode && compressed)
+    snprintf(buf, size, "e %i %i %016llx %016llx %s %s", compressed, headerskip, (unsigned long long)key1, (unsigned long long)key2,
+             streamed ? "stream" : "file", cache_deflate_settings(deflate, sizeof(deflate)));
+  else
+    snprintf(buf, size, "%c %i %i %016llx %016llx", encode ? 'e' : 'd', compressed, headerskip, (unsigned long long)key1, (unsigned long long)key2);
+
+  return buf;
+}
+
+// <dir>/xx/xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx, plus room for a temporary suffix
+static char *entrypath (const cachekey_t *key, int subdironly)
+{
+  char *path;
+  char hex[33];
+
+  path = malloc(strlen(cachedir) + 64);
+  if (!path)
+    return NULL;
+
+  snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)key->h[0], (unsigned long long)key->h[1]);
+
+  if (subdironly)
+    sprintf(path, "%s/%.2s", cachedir, hex);
+  else
+    sprintf(path, "%s/%.2s/%s", cachedir, hex, hex);
+
+  return path;
+}
+
+#ifdef _WIN32
+
+static int makedir (const char *path)
+{
+  if (!CreateDirectoryA(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    return -1;
+
+  return 0;
+}
+
+static unsigned int processid (void)
+{
+  return (unsigned int)GetCurrentProcessId();
+}
+
+// windows has no reflinks for ordinary volumes and won't delete read-only files,
+// so entries stay writable there
+static int storefile (const char *src, const char *dst)
+{
+  return CopyFileA(src, dst, FALSE) ? 0 : -1;
+}
+
+static int publish (const char *tmp, const char *dst)
+{
+  return MoveFileExA(tmp, dst, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+}
+
+static int fetchfile (const char *src, const char *dst, uint64_t *size)
+{
+  WIN32_FILE_ATTRIBUTE_DATA fad;
+
+  if (!GetFileAttributesExA(src, GetFileExInfoStandard, &fad))
+    return -1;
+
+  DeleteFileA(dst);
+  if (!CreateHardLinkA(dst, src, NULL) && !CopyFileA(src, dst, FALSE))
+    return -1;
+
+  *size = ((uint64_t)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+  return 0;
+}
+
+#else // not _WIN32
+
+static int makedir (const char *path)
+{
+  if (mkdir(path, 0755) < 0 && errno != EEXIST)
+    return -1;
+
+  return 0;
+}
+
+static unsigned int processid (void)
+{
+  return (unsigned int)getpid();
+}
+
+static int copyfd (int in, int out)
+{
+  uint8_t *buf;
+  ssize_t n, w;
+  int r;
+
+#ifdef FICLONE
+  // same filesystem and it can share the blocks, nothing is copied
+  if (ioctl(out, FICLONE, in) == 0)
+    return 0;
+#endif
+
+  buf = malloc(CACHE_CHUNK);
+  if (!buf)
+    return -1;
+
+  r = 0;
+  while (!r && (n = read(in, buf, CACHE_CHUNK)) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno != EINTR)
+        r = -1;
+      continue;
+    }
+
+    for (w=0; !r && w<n; )
+    {
+      ssize_t k = write(out, buf+w, n-w);
+
+      if (k < 0 && errno != EINTR)
+        r = -1;
+      else if (k > 0)
+        w += k;
+    }
+  }
+
+  free(buf);
+  return r;
+}
+
+static int copyfile (const char *src, const char *dst, mode_t mode)
+{
+  int in, out, r;
+
+  in = open(src, O_RDONLY);
+  if (in < 0)
+    return -1;
+
+  out = open(dst, O_WRONLY|O_CREAT|O_EXCL, mode);
+  if (out < 0)
+  {
+    close(in);
+    return -1;
+  }
+
+  r = copyfd(in, out);
+  close(in);
+
+  if (close(out) < 0)
+    r = -1;
+
+  if (r)
+    unlink(dst);
+
+  return r;
+}
+
+static int storefile (const char *src, const char *dst)
+{
+  return copyfile(src, dst, 0444);
+}
+
+static int publish (const char *tmp, const char *dst)
+{
+  return rename(tmp, dst) < 0 ? -1 : 0;
+}
+
+static int fetchfile (const char *src, const char *dst, uint64_t *size)
+{
+  struct stat statbuf;
+  int in, out, r;
+
+  if (stat(src, &statbuf) < 0)
+    return -1;
+
+  unlink(dst);
+
+  // a reflink gives the output its own writable inode, a hardlink shares the
+  // read-only entry
+  r = -1;
+#ifdef FICLONE
+  in = open(src, O_RDONLY);
+  if (in >= 0)
+  {
+    out = open(dst, O_WRONLY|O_CREAT|O_EXCL, 0644);
+    if (out >= 0)
+    {
+      r = ioctl(out, FICLONE, in) ? -1 : 0;
+      close(out);
+      if (r)
+        unlink(dst);
+    }
+    close(in);
+  }
+#endif
+
+  if (r)
+    r = link(src, dst) ? -1 : 0;
+
+  if (r)
+    r = copyfile(src, dst, 0644);
+
+  *size = statbuf.st_size;
+  return r;
+}
+
+#endif // _WIN32
+
+#define SUM_EXT ".sum"
+#define SUM_SETTINGS "entry"
+
+static int writesum (const char *entry, const char *sumpath)
+{
+  cachekey_t hash;
+  uint64_t size;
+  FILE *fp;
+  int r;
+
+  if (hashfile(&hash, &size, entry, SUM_SETTINGS))
+    return -1;
+
+  fp = fopen(sumpath, "w");
+  if (!fp)
+    return -1;
+
+  r = fprintf(fp, "%llu %016llx%016llx\n", (unsigned long long)size, (unsigned long long)hash.h[0], (unsigned long long)hash.h[1]) < 0 ? -1 : 0;
+  if (fclose(fp))
+    r = -1;
+
+  if (r)
+    remove(sumpath);
+
+  return r;
+}
+
+// 0 if the entry is there and matches its sum, 1 if it's there but doesn't
+// (or has no sum), -1 if there is no entry
+static int checkentry (const char *entry, const char *sumpath)
+{
+  cachekey_t hash;
+  unsigned long long sumsize, h0, h1;
+  uint64_t size;
+  FILE *fp;
+  int n;
+
+  if (hashfile(&hash, &size, entry, SUM_SETTINGS))
+    return -1;
+
+  fp = fopen(sumpath, "r");
+  if (!fp)
+    return 1;
+
+  n = fscanf(fp, "%llu %16llx%16llx", &sumsize, &h0, &h1);
+  fclose(fp);
+
+  if (n != 3 || sumsize != size || h0 != hash.h[0] || h1 != hash.h[1])
+    return 1;
+
+  return 0;
+}
+
+int cache_set_dir (const char *dir)
+{
+  if (makedir(dir))
+    return -1;
+
+  free(cachedir);
+  cachedir = strdup(dir);
+  if (!cachedir)
+    return -1;
+
+  mutex_init(&cachelock);
+  return 0;
+}
+
+int cache_enabled (void)
+{
+  return cachedir != NULL;
+}
+
+int cache_fetch (const cachekey_t *key, const char *outpath, uint64_t *size)
+{
+  uint64_t dummy;
+  char *path, *sumpath;
+  int r;
+
+  path = entrypath(key, 0);
+  sumpath = path ? malloc(strlen(path) + sizeof(SUM_EXT)) : NULL;
+  if (!sumpath)
+  {
+    free(path);
+    remove(outpath);
+    return -1;
+  }
+
+  sprintf(sumpath, "%s" SUM_EXT, path);
+
+  r = checkentry(path, sumpath);
+  if (r > 0)
+  {
+    remove(path);
+    remove(sumpath);
+  }
+
+  if (!r)
+    r = fetchfile(path, outpath, size ? size : &dummy);
+
+  free(sumpath);
+  free(path);
+
+  if (r)
+    remove(outpath);
+
+  return r;
+}
+
+int cache_store (const cachekey_t *key, const char *outpath)
+{
+  char *path, *tmp, *sumtmp, *sumpath;
+  unsigned int n;
+  int r;
+
+  path = entrypath(key, 1);
+  if (!path)
+    return -1;
+
+  r = makedir(path);
+  free(path);
+  if (r)
+    return -1;
+
+  path = entrypath(key, 0);
+  tmp = path ? malloc(strlen(path) + 32) : NULL;
+  sumtmp = path ? malloc(strlen(path) + 32 + sizeof(SUM_EXT)) : NULL;
+  sumpath = path ? malloc(strlen(path) + sizeof(SUM_EXT)) : NULL;
+  if (!tmp || !sumtmp || !sumpath)
+  {
+    free(sumpath);
+    free(sumtmp);
+    free(tmp);
+    free(path);
+    return -1;
+  }
+
+  // written under a unique name and renamed, so nobody ever sees half an entry
+  mutex_lock(&cachelock);
+  n = tmpcounter++;
+  mutex_unlock(&cachelock);
+  sprintf(tmp, "%s.%u.%u.tmp", path, processid(), n);
+  sprintf(sumtmp, "%s" SUM_EXT ".%u.%u.tmp", path, processid(), n);
+  sprintf(sumpath, "%s" SUM_EXT, path);
+
+  // the sum of the copy goes first, so a published entry always has one
+  r = storefile(outpath, tmp);
+  if (!r)
+    r = writesum(tmp, sumtmp);
+  if (!r)
+    r = publish(sumtmp, sumpath);
+  if (!r)
+    r = publish(tmp, path);
+
+  if (r)
+  {
+    remove(tmp);
+    remove(sumtmp);
+  }
+
+  free(sumpath);
+  free(sumtmp);
+  free(tmp);
+  free(path);
+
+  return r;
+}
@@ -0,0 +1,48 @@
+//
+// content-addressed conversion cache, header
+//
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+  uint64_t h[2];
+}
+cachekey_t;
+
+// the cache is off until a directory is set, which is created if needed.
+// call before starting threads. returns -1 if the directory can't be created
+extern int cache_set_dir (const char *dir);
+extern int cache_enabled (void);
+
+// key of an input's content together with everything else its output depends on
+// (direction, filetype keys, compression settings...) given as a free-form string.
+// cache_key_file returns -1 if the file can't be read
+extern int cache_key_file (cachekey_t *key, const char *path, const char *settings);
+extern void cache_key_buffer (cachekey_t *key, const void *data, size_t len, const char *settings);
+
+// plain XXH64 of a buffer, for content checks outside of the cache
+extern uint64_t cache_hash (const void *data, size_t len, uint64_t seed);
+
+// deflate backend, level and strategy, for the settings of encodes
+extern const char *cache_deflate_settings (char *buf, size_t size);
+
+// settings of an inti_encdec conversion (compressed is one of COMP_*, streamed is
+// set for inti_stream_file, whose deflate output differs from the one-shot one)
+extern const char *cache_conv_settings (char *buf, size_t size, int encode, int streamed, int compressed, int headerskip, uint64_t key1, uint64_t key2);
+
+// on a hit the cached output is put at outpath (reflinked, hardlinked or copied)
+// and 0 returned, size receives its size (may be NULL). on a miss -1 is returned
+// and outpath removed, so writing the new output can't change a cached file it
+// may still be linked to
+extern int cache_fetch (const cachekey_t *key, const char *outpath, uint64_t *size);
+
+// copies a freshly written output into the cache (reflinked where possible),
+// returns -1 if that failed, which only costs a later hit
+extern int cache_store (const cachekey_t *key, const char *outpath);
+
+#endif // __CACHE_H__
@@ -25,6 +25,12 @@ void inti_encdec (uint8_t *buffer, int mode, int len, uint64_t key)
   uint64_t blockkey;
   uint8_t tmp;
 
+  if (mode == MODE_DEC)
+  {
+    inti_dec_from(buffer, len, key, 0);
+    return;
+  }
+
   blockkey = key;
 
   for (i=0; i<len; i++)
@@ -39,4 +45,42 @@ void inti_encdec (uint8_t *buffer, int mode, int len, uint64_t key)
 
     blockkey *= 141;
   }
+}
+
+uint64_t inti_dec_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos)
+{
+  size_t head, numblocks;
+
+  // bytes up to the next 32 byte boundary, then whole blocks, then the rest
+  head = (32 - (pos & 0x1F)) & 0x1F;
+  if (head > len)
+    head = len;
+
+  blockkey = inti_dec_scalar(buffer, head, blockkey, pos);
+  buffer += head;
+  pos += head;
+  len -= head;
+
+  numblocks = len / 32;
+  if (numblocks)
+    blockkey = inti_dec_blocks(buffer, numblocks, blockkey);
+
+  return inti_dec_scalar(buffer+numblocks*32, len-numblocks*32, blockkey, pos+numblocks*32);
+}
+
+uint64_t inti_dec_scalar (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos)
+{
+  size_t i;
+  uint8_t tmp;
+
+  for (i=0; i<len; i++)
+  {
+    tmp = buffer[i];
+    buffer[i] = tmp ^ ((blockkey>>((pos+i)&0x1F))&0xFF);
+
+    blockkey += tmp;
+    blockkey *= 141;
+  }
+
+  return blockkey;
 }
\ No newline at end of file
@@ -2,15 +2,30 @@
 #define __ENCDEC_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define INTI_BASEKEY 0xA1B34F58CAD705B2ULL
+#define INTI_CONST1 141
 
 enum {
   MODE_ENC,
   MODE_DEC
 };
 
+enum {
+  INTI_SIMD_NONE,
+  INTI_SIMD_AVX2
+};
+
 extern uint64_t inti_keygen (const char *keystr);
 extern void inti_encdec (uint8_t *buffer, int mode, int len, uint64_t key);
 
+extern uint64_t inti_dec_from (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos); // descramble starting at stream offset pos, returns the next blockkey
+extern uint64_t inti_dec_scalar (uint8_t *buffer, size_t len, uint64_t blockkey, size_t pos); // same, plain byte loop
+
+// simddec.c: whole 32 byte blocks (starting on a multiple of 32), vectorized if the cpu allows
+extern uint64_t inti_dec_blocks (uint8_t *buffer, size_t numblocks, uint64_t blockkey);
+extern void inti_dec_set_simd (int level); // INTI_SIMD_*, -1 or unsupported = best available
+extern int inti_dec_get_simd (void);
+
 #endif // __ENCDEC_H__
\ No newline at end of file
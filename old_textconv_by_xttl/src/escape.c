@@ -0,0 +1,234 @@
+//
+// escaping of TTB strings for the text dumps
+//
+// nearly all bytes of a string pass through unchanged, so both directions look
+// for the next byte that doesn't and copy the span in front of it in one go.
+// escaping scans 16 bytes at a time with SSE2, or 32 with AVX2 where the cpu
+// has it, for control characters, 0x7F and backslashes. unescaping only has to
+// find backslashes, which memchr already does vectorized
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "encdec.h"
+#include "escape.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #define ESC_SSE2
+ #include <immintrin.h>
+ #ifdef _MSC_VER
+  #include <intrin.h>
+  #define ESC_TARGET(x)
+ #else
+  #define ESC_TARGET(x) __attribute__((target(x)))
+ #endif
+#endif
+
+#define NEEDS_ESCAPE(c) ((c) < 0x20 || (c) == 0x7F || (c) == '\\')
+
+static const char hexdigits[] = "0123456789ABCDEF";
+
+// offset of the first byte that needs escaping, len if there's none
+static size_t scan_scalar (const uint8_t *p, size_t len)
+{
+  size_t i;
+
+  for (i=0; i<len; i++)
+  {
+    if (NEEDS_ESCAPE(p[i]))
+      break;
+  }
+
+  return i;
+}
+
+#ifdef ESC_SSE2
+
+static inline int lowestbit (unsigned int mask)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+
+  _BitScanForward(&i, mask);
+  return i;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+static size_t scan_sse2 (const uint8_t *p, size_t len)
+{
+  const __m128i ctl = _mm_set1_epi8(0x1F), del = _mm_set1_epi8(0x7F), bs = _mm_set1_epi8('\\');
+  __m128i v, m;
+  unsigned int mask;
+  size_t i;
+
+  for (i=0; i+16<=len; i+=16)
+  {
+    v = _mm_loadu_si128((const __m128i*)(p+i));
+
+    // unsigned v <= 0x1F is min(v,0x1F) == v
+    m = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v);
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bs));
+
+    mask = _mm_movemask_epi8(m);
+    if (mask)
+      return i + lowestbit(mask);
+  }
+
+  return i + scan_scalar(p+i, len-i);
+}
+
+ESC_TARGET("avx2")
+static size_t scan_avx2 (const uint8_t *p, size_t len)
+{
+  const __m256i ctl = _mm256_set1_epi8(0x1F), del = _mm256_set1_epi8(0x7F), bs = _mm256_set1_epi8('\\');
+  __m256i v, m;
+  unsigned int mask;
+  size_t i;
+
+  for (i=0; i+32<=len; i+=32)
+  {
+    v = _mm256_loadu_si256((const __m256i*)(p+i));
+
+    m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, del));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bs));
+
+    mask = _mm256_movemask_epi8(m);
+    if (mask)
+      return i + lowestbit(mask);
+  }
+
+  return i + scan_sse2(p+i, len-i);
+}
+
+#endif // ESC_SSE2
+
+typedef size_t (*scan_t)(const uint8_t *p, size_t len);
+
+static scan_t scan = NULL;
+
+// the cpu detection of the descrambler decides between SSE2 and AVX2
+static void pick_scan (void)
+{
+#ifdef ESC_SSE2
+  if (inti_dec_get_simd() >= INTI_SIMD_AVX2)
+    scan = scan_avx2;
+  else
+    scan = scan_sse2;
+#else
+  scan = scan_scalar;
+#endif
+}
+
+size_t escape_string (uint8_t *dst, const uint8_t *src, size_t len)
+{
+  size_t si, di, n;
+  uint8_t c;
+
+  if (!scan)
+    pick_scan();
+
+  si = di = 0;
+  for (;;)
+  {
+    n = scan(src+si, len-si);
+    memcpy(dst+di, src+si, n);
+    si += n;
+    di += n;
+
+    if (si == len)
+      break;
+
+    c = src[si++];
+    dst[di++] = '\\';
+
+    if (c == '\n') // newlines
+      dst[di++] = 'n';
+    else if (c == '\r') // carriage returns
+      dst[di++] = 'r';
+    else if (c == '\t') // tabs
+      dst[di++] = 't';
+    else if (c == '\b') // backspaces
+      dst[di++] = 'b';
+    else if (c == '\\') // so it isn't taken for an escape when read back
+      dst[di++] = '\\';
+    // ...and all chars in C0 control code range, and #127
+    else
+    {
+      dst[di++] = 'x';
+      dst[di++] = hexdigits[c >> 4];
+      dst[di++] = hexdigits[c & 0xF];
+    }
+  }
+
+  return di;
+}
+
+static int nybble (uint8_t c)
+{
+  if (c >= '0' && c <= '9')
+    return c-'0';
+  if (c >= 'A' && c <= 'F')
+    return c-'A'+10;
+  if (c >= 'a' && c <= 'f')
+    return c-'a'+10;
+
+  return -1;
+}
+
+int unescape_string (uint8_t *dst, const uint8_t *src)
+{
+  const uint8_t *p;
+  size_t si, di, n, len;
+  int x, y;
+
+  len = strlen((const char*)src);
+
+  si = di = 0;
+  for (;;)
+  {
+    p = memchr(src+si, '\\', len-si);
+    n = p ? (size_t)(p-(src+si)) : len-si;
+
+    // dst is never behind src, so this only moves spans down
+    memmove(dst+di, src+si, n);
+    si += n;
+    di += n;
+
+    if (!p)
+      break;
+
+    switch (src[si+1])
+    {
+      case 'n': dst[di++] = '\n'; break;
+      case 'r': dst[di++] = '\r'; break;
+      case 't': dst[di++] = '\t'; break;
+      case 'b': dst[di++] = '\b'; break;
+      case '\\': dst[di++] = '\\'; break;
+
+      case 'x':
+        x = nybble(src[si+2]);
+        y = x < 0 ? -1 : nybble(src[si+3]);
+        if (y < 0)
+          return -1;
+
+        dst[di++] = (x<<4)|y;
+        si += 2;
+        break;
+
+      default:
+        return -1;
+    }
+
+    si += 2;
+  }
+
+  dst[di] = 0;
+
+  return (int)di;
+}
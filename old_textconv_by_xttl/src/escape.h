@@ -0,0 +1,21 @@
+//
+// escaping of TTB strings for the text dumps, header
+//
+
+#ifndef __ESCAPE_H__
+#define __ESCAPE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// writes the escaped form of len bytes at src to dst, which needs room for
+// 4*len bytes: \n \r \t \b and \\ for those, \xNN for the rest of the C0
+// range and 0x7F. returns the escaped length
+extern size_t escape_string (uint8_t *dst, const uint8_t *src, size_t len);
+
+// unescapes the NUL-terminated src into dst, which may be src itself or in
+// front of it, and NUL-terminates it. returns the unescaped length, or -1 on a
+// bad escape sequence
+extern int unescape_string (uint8_t *dst, const uint8_t *src);
+
+#endif // __ESCAPE_H__
@@ -0,0 +1,14 @@
+//
+// work-stealing thread pool, header
+//
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+typedef void (*pooljob_t)(void *ctx, int job);
+
+// runs func(ctx, job) for every job in 0..numjobs-1 on numthreads workers (<= 0 means one per cpu),
+// jobs should be numbered from most to least expensive
+extern void pool_run(int numthreads, int numjobs, pooljob_t func, void *ctx);
+
+#endif // __POOL_H__
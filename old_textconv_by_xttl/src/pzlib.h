@@ -0,0 +1,31 @@
+//
+// parallel zlib compression, header
+//
+
+#ifndef __PZLIB_H__
+#define __PZLIB_H__
+
+#include <zlib.h>
+
+#define PZ_BLOCKSIZE (128*1024)
+#define PZ_DICTSIZE (32*1024)
+
+// like compressBound()/compress2(), but deflates PZ_BLOCKSIZE blocks on numthreads
+// threads (<= 0 means one per cpu) and stitches them into one ordinary zlib stream.
+// strategy is handed to deflateInit2() (Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, ...).
+// inputs that fit in two blocks go straight to compress2(), so small files come out
+// byte-identical to the single-threaded result
+extern uLong pz_compressBound (uLong sourcelen);
+extern int pz_compress2 (Bytef *dest, uLongf *destlen, const Bytef *source, uLong sourcelen, int level, int strategy, int numthreads);
+
+// the pieces of the stitched stream, for producing it block by block: the 2-byte
+// zlib header, then every block raw-deflated with the (up to PZ_DICTSIZE) dictlen
+// bytes of input in front of source as dictionary, all but the last ending with a
+// sync flush. destlen is the room at dest, pz_blockBound(len) is always enough,
+// and receives the compressed size. the trailer is the big endian adler32 of the
+// whole input
+extern unsigned int pz_header (int level, int strategy);
+extern uLong pz_blockBound (uLong len);
+extern int pz_deflate_block (Bytef *dest, uLong *destlen, const Bytef *source, uLong len, uLong dictlen, int level, int strategy, int last);
+
+#endif // __PZLIB_H__
@@ -9,8 +9,10 @@
 
 #include "encdec.h"
 #include "ttbfile.h"
-
-#define MAXRECORDS 512
+#include "threads.h"
+#include "zback.h"
+#include "cache.h"
+#include "escape.h"
 
 typedef uint8_t byte;
 
@@ -28,32 +30,26 @@ static void Error (char *err, ...)
   exit(-1);
 }
 
+// strings are escaped into one buffer, which grows with the longest one, and
+// written out with a single fwrite each (see escape.c)
 static void writestring(FILE *txtfp, byte *str)
 {
-  int i, len;
-  uint8_t chr;
+  static byte *escbuf = NULL;
+  static size_t escsize = 0;
+  size_t len;
 
   len = strlen(str);
 
-  for (i=0; i<len; i++)
+  if (4*len > escsize)
   {
-    chr = str[i];
-
-    if (chr == '\n') // escape newlines
-      fprintf(txtfp, "\\n");
-    else if (chr == '\r') // carriage returns
-      fprintf(txtfp, "\\r");
-    else if (chr == '\t') // tabs
-      fprintf(txtfp, "\\t");
-    else if (chr == '\b') // backspaces
-      fprintf(txtfp, "\\b");
-    // ...and all chars in C0 control code range, and #127
-    else if (chr < 0x20 || chr == 0x7F)
-      fprintf(txtfp, "\\x%02X", chr);
-    // otherwise let it pass
-    else
-      fputc(chr,txtfp);
+    escsize = 4*len > 4096 ? 4*len : 4096;
+    escbuf = realloc(escbuf, escsize);
+    if (!escbuf)
+      Error("failed to allocate memory for escaping strings");
   }
+
+  len = escape_string(escbuf, str, len);
+  fwrite(escbuf, 1, len, txtfp);
 }
 
 static void DumpTTB (FILE *txtfp, byte *ttbdata, int ttblen)
@@ -72,13 +68,10 @@ static void DumpTTB (FILE *txtfp, byte *ttbdata, int ttblen)
   numrecords = 0;
 
   // first, count the records
-  while (ttbrec->offset > 32 && ttbrec->offset < ttblen)
+  while ((byte*)(ttbrec+1) <= ttbdata+ttblen && ttbrec->offset > 32 && ttbrec->offset < ttblen)
   {
     ttbrec++;
     numrecords++;
-
-    if (numrecords > MAXRECORDS)
-      Error("too many records");
   }
 
   // first line in dump file: # of records
@@ -108,6 +101,7 @@ static void TTB2TXT (char *txtpath, char *ttbpath)
 {
   FILE *ttbfp, *txtfp;
   uint32_t clen, ulen;
+  size_t zlen;
   uint64_t key;
   byte *cbuf, *ubuf;
   int r;
@@ -116,9 +110,11 @@ static void TTB2TXT (char *txtpath, char *ttbpath)
   if (!ttbfp)
     Error("TTB2TXT: Failed to open input TTB file '%s'", ttbpath);
 
+  remove(txtpath); // may be a hardlink into the conversion cache
   txtfp = fopen(txtpath, "w");
   if (!txtfp)
     Error("TTB2TXT: Failed to open output TXT file '%s'", txtpath);
+  setvbuf(txtfp, NULL, _IOFBF, 1<<16);
 
   fseek(ttbfp, 0, SEEK_END);
   clen = ftell(ttbfp);
@@ -143,248 +139,657 @@ static void TTB2TXT (char *txtpath, char *ttbpath)
   if (!ubuf)
     Error("TTB2TXT: Failed to allocate %i bytes for decompressed data buffer", ulen);
   
-  r = uncompress(ubuf, (uLongf*)&ulen, cbuf+sizeof(int32_t), clen-sizeof(int32_t));
+  zlen = ulen;
+  r = zback_uncompress(ubuf, &zlen, cbuf+sizeof(int32_t), clen-sizeof(int32_t));
   if (r != Z_OK)
     Error("TTB2TXT: zlib decompression failed, error code %i", r);
+  ulen = zlen;
   
   free(cbuf);
 
   DumpTTB(txtfp, ubuf, ulen);
+  fclose(txtfp);
 
   free(ubuf);
 }
 
-#define MAXSTRING 2048
-static byte linebuf[MAXSTRING];
-
 typedef struct
 {
   uint32_t u1,u2,u3;
-  byte *string;
+  byte *string; // in the arena, at offset
   int length;
   int offset;
 }
 tmprec_t;
 
-static inline byte convertnybble (byte b)
+// the whole TXT file goes into one arena, which grows as needed. unescaping
+// never makes a string longer, so each string is unescaped in place to where
+// it goes in the TTB, behind the header and record table built in front of the
+// text, and the arena ends up holding the TTB data as it gets compressed
+typedef struct
 {
-  b = toupper(b);
+  byte *data;
+  size_t len, size;
+}
+arena_t;
 
-  if (b >= '0' && b <= '9')
-    b -= '0';
-  else if (b >= 'A' && b <= 'F')
-    b = b-'A'+10;
-  else
-    Error("convertnybble: bad character encountered");
+// makes room for n more bytes plus the NUL that always follows the text
+static void arena_reserve (arena_t *arena, size_t n)
+{
+  size_t size;
+
+  if (arena->len + n + 1 <= arena->size)
+    return;
+
+  size = arena->size ? arena->size : 65536;
+  while (size < arena->len + n + 1)
+    size *= 2;
 
-  return b;
+  arena->data = realloc(arena->data, size);
+  if (!arena->data)
+    Error("failed to allocate %u bytes for TXT arena", (unsigned int)size);
+  arena->size = size;
+}
+
+// cuts the next line out of the text at *pos (without its \n or \r\n),
+// returns NULL at the end of the text
+static byte *nextline (byte **pos, byte *end)
+{
+  byte *line, *eol;
+
+  line = *pos;
+  if (line >= end)
+    return NULL;
+
+  eol = memchr(line, '\n', end-line);
+  if (!eol)
+    eol = end;
+
+  *pos = (eol < end) ? eol+1 : end;
+
+  if (eol > line && eol[-1] == '\r')
+    eol--;
+  *eol = 0;
+
+  return line;
 }
 
 int readstring (byte *dst, byte *src)
 {
-  int si,di;
-  int srclen;
+  int len;
+
+  len = unescape_string(dst, src);
+  if (len < 0)
+    Error("bad escape sequence encountered while parsing string");
+
+  return len;
+}
+
+// incremental repacking (-i): <ttb>.manifest remembers what the TTB was built
+// from, the hash of the whole text file and of every record, so an unchanged
+// text file costs one hash and a text file whose records didn't change (only
+// line endings or a BOM) one parse, and neither rewrites the TTB
+#define MANIFEST_EXT ".manifest"
+#define MANIFEST_MAGIC "textconv manifest 1"
+
+typedef struct
+{
+  char settings[96];  // deflate settings the TTB was compressed with
+  cachekey_t txt;     // of the text file
+  cachekey_t ttb;     // of the TTB written from it
+  int numrecords;
+  cachekey_t *records;
+}
+manifest_t;
 
-  srclen = strlen(src);
+static int keyequal (const cachekey_t *a, const cachekey_t *b)
+{
+  return a->h[0] == b->h[0] && a->h[1] == b->h[1];
+}
 
-  di = si = 0;
+static int readkey (FILE *fp, const char *name, cachekey_t *key)
+{
+  char line[128], fmt[32];
+  unsigned long long h0, h1;
 
-  while (si < srclen)
+  if (!fgets(line, sizeof(line), fp))
+    return -1;
+
+  snprintf(fmt, sizeof(fmt), "%s %%16llx%%16llx", name);
+  if (sscanf(line, fmt, &h0, &h1) < 2)
+    return -1;
+
+  key->h[0] = h0;
+  key->h[1] = h1;
+  return 0;
+}
+
+static void writekey (FILE *fp, const char *name, const cachekey_t *key)
+{
+  fprintf(fp, "%s %016llx%016llx\n", name, (unsigned long long)key->h[0], (unsigned long long)key->h[1]);
+}
+
+// returns -1 if there's no manifest or it can't be used
+static int ReadManifest (manifest_t *man, const char *path)
+{
+  FILE *fp;
+  char line[128];
+  int i, r;
+
+  memset(man, 0, sizeof(manifest_t));
+
+  fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  r = -1;
+  if (fgets(line, sizeof(line), fp) && !strcmp(line, MANIFEST_MAGIC "\n") &&
+      fgets(line, sizeof(line), fp) && sscanf(line, "settings %95[^\n]", man->settings) == 1 &&
+      !readkey(fp, "txt", &man->txt) && !readkey(fp, "ttb", &man->ttb) &&
+      fgets(line, sizeof(line), fp) && sscanf(line, "records %i", &man->numrecords) == 1 &&
+      man->numrecords >= 0)
   {
-    if (src[si]=='\\')
+    man->records = malloc(sizeof(cachekey_t)*(man->numrecords+1));
+
+    for (i=0; man->records && i<man->numrecords; i++)
     {
-      if (src[si+1]=='n')
-      {
-        dst[di++] = '\n';
-        si += 2;
-      }
-      else if (src[si+1]=='r')
-      {
-        dst[di++] = '\r';
-        si += 2;
-      }
-      else if (src[si+1]=='t')
-      {
-        dst[di++] = '\t';
-        si += 2;
-      }
-      else if (src[si+1]=='b')
-      {
-        dst[di++] = '\b';
-        si += 2;
-      }
-      else if (src[si+1]=='x')
-      {
-        byte b,x,y;
+      if (readkey(fp, "record", &man->records[i]))
+        break;
+    }
 
-        x = convertnybble(src[si+2]);
-        y = convertnybble(src[si+3]);
+    if (man->records && i == man->numrecords)
+      r = 0;
+  }
 
-        b = (x<<4)|y;
-        dst[di++] = b;
+  fclose(fp);
 
-        si += 4;
-      }
-      else
-        Error("bad escape sequence encountered while parsing string");
+  if (r)
+  {
+    free(man->records);
+    memset(man, 0, sizeof(manifest_t));
+  }
+
+  return r;
+}
+
+static void WriteManifest (const manifest_t *man, const char *path)
+{
+  FILE *fp;
+  int i;
+
+  remove(path);
+  fp = fopen(path, "w");
+  if (!fp)
+    Error("Failed to open manifest file '%s'", path);
+
+  fprintf(fp, MANIFEST_MAGIC "\n");
+  fprintf(fp, "settings %s\n", man->settings);
+  writekey(fp, "txt", &man->txt);
+  writekey(fp, "ttb", &man->ttb);
+  fprintf(fp, "records %i\n", man->numrecords);
+  for (i=0; i<man->numrecords; i++)
+    writekey(fp, "record", &man->records[i]);
+
+  if (fclose(fp))
+    Error("Failed to write manifest file '%s'", path);
+}
+
+// packing (-p): records with the same string share one copy of it, and a string
+// that is the tail of a longer one points into that, the way linkers merge
+// string literals. the game only follows the offsets, but the TTBs it ships
+// never do this, so it's opt-in
+static uint64_t hashstring (const byte *str, int len)
+{
+  uint64_t h;
+  int i;
+
+  h = 0xCBF29CE484222325ULL; // FNV-1a
+  for (i=0; i<len; i++)
+  {
+    h ^= str[i];
+    h *= 0x100000001B3ULL;
+  }
+
+  return h;
+}
+
+// orders strings by their last byte, then the one before...
+static int tailcompare (const void *a, const void *b)
+{
+  const tmprec_t *x = *(const tmprec_t**)a, *y = *(const tmprec_t**)b;
+  int i, j;
+
+  for (i=x->length-1, j=y->length-1; i>=0 && j>=0; i--, j--)
+  {
+    if (x->string[i] != y->string[j])
+      return x->string[i] - y->string[j];
+  }
+
+  return x->length - y->length;
+}
+
+// shares the strings laid out from headlen on in ttbdata, moves the ones that
+// keep their copy down over the others and points the record table at them.
+// returns the new length of the TTB data, shared receives the number of records
+// that use another one's string
+static size_t PackTTB (byte *ttbdata, tmprec_t *recs, int numrecords, size_t headlen, int *shared)
+{
+  int *table, *host;
+  tmprec_t **unique, *a, *b;
+  size_t tablesize, k, offset;
+  int i, j, numunique;
+  ttbrec_t ttbrec;
+
+  for (tablesize=16; tablesize < 2*(size_t)numrecords; tablesize *= 2)
+    ;
+
+  host = malloc(sizeof(int)*(numrecords+1));
+  unique = malloc(sizeof(tmprec_t*)*(numrecords+1));
+  table = malloc(sizeof(int)*tablesize);
+  if (!host || !unique || !table)
+    Error("failed to allocate memory for string packing");
+
+  memset(table, -1, sizeof(int)*tablesize);
+
+  // identical strings, the hash table keeps this linear. host is the record
+  // holding the copy a record uses
+  numunique = 0;
+  for (i=0; i<numrecords; i++)
+  {
+    for (k = hashstring(recs[i].string, recs[i].length) & (tablesize-1); (j = table[k]) >= 0; k = (k+1) & (tablesize-1))
+    {
+      if (recs[j].length == recs[i].length && !memcmp(recs[j].string, recs[i].string, recs[i].length))
+        break;
     }
+
+    if (j >= 0)
+      host[i] = j;
     else
-      dst[di++] = src[si++];
+    {
+      table[k] = i;
+      host[i] = i;
+      unique[numunique++] = &recs[i];
+    }
+  }
+
+  // tails: sorted from the end, a string that ends another one comes right
+  // before it or before a string that ends with it too
+  qsort(unique, numunique, sizeof(tmprec_t*), tailcompare);
+  for (i=numunique-2; i>=0; i--)
+  {
+    a = unique[i];
+    b = unique[i+1];
+
+    if (a->length <= b->length && !memcmp(a->string, b->string + b->length - a->length, a->length))
+      host[a-recs] = host[b-recs];
   }
 
-  dst[di] = 0;
+  // the copies that are kept stay in record order, so each moves down
+  offset = headlen;
+  for (i=0; i<numrecords; i++)
+  {
+    if (host[i] != i)
+      continue;
+
+    memmove(ttbdata+offset, recs[i].string, recs[i].length+1);
+    recs[i].string = ttbdata+offset;
+    recs[i].offset = offset;
+    offset += recs[i].length+1;
+  }
+
+  *shared = 0;
+  for (i=0; i<numrecords; i++)
+  {
+    // a duplicate's host may itself be the tail of another string
+    j = host[host[i]];
+    if (j != i)
+    {
+      recs[i].offset = recs[j].offset + recs[j].length - recs[i].length;
+      recs[i].string = ttbdata+recs[i].offset;
+      (*shared)++;
+    }
+
+    memcpy(&ttbrec, ttbdata+sizeof(ttbhead_t)+i*sizeof(ttbrec_t), sizeof(ttbrec_t));
+    ttbrec.offset = recs[i].offset;
+    memcpy(ttbdata+sizeof(ttbhead_t)+i*sizeof(ttbrec_t), &ttbrec, sizeof(ttbrec_t));
+  }
+
+  free(table);
+  free(unique);
+  free(host);
 
-  return di;
+  return offset;
 }
 
-void TXT2TTB (char *ttbpath, char *txtpath)
+void TXT2TTB (char *ttbpath, char *txtpath, int incremental, int pack)
 {
   FILE *ttbfp, *txtfp;
   int i, j, r, numrecords;
   tmprec_t *tmprecs;
   byte *ttbdata, *zdata;
   uint32_t clen, ulen;
+  size_t zlen;
   ttbhead_t ttbhead;
   ttbrec_t ttbrec;
-  uint32_t offset;
+  arena_t arena;
+  byte *pos, *end;
+  size_t n, headlen, offset;
   uint64_t key;
+  double start;
+  char manpath[1024], deflate[64], changes[64];
+  manifest_t old, man;
+  cachekey_t ttbkey;
+  int havettb, valid, changed, shared;
 
-  ttbfp = fopen(ttbpath, "wb");
-  if (!ttbfp)
-    Error("TXT2TTB: Failed to open output TTB file '%s'", ttbpath);
+  start = wallclock();
+
+  memset(&old, 0, sizeof(manifest_t));
+  memset(&man, 0, sizeof(manifest_t));
+  havettb = valid = 0;
+  changes[0] = 0;
+
+  if (incremental)
+  {
+    snprintf(manpath, sizeof(manpath), "%s" MANIFEST_EXT, ttbpath);
+    snprintf(man.settings, sizeof(man.settings), "%s%s", cache_deflate_settings(deflate, sizeof(deflate)), pack ? " packed" : "");
+
+    if (cache_key_file(&man.txt, txtpath, "textconv txt"))
+      Error("TXT2TTB: Failed to open input  TXT file '%s'", txtpath);
+
+    // the manifest only counts while the TTB is still the one it was written for
+    havettb = !cache_key_file(&ttbkey, ttbpath, "textconv ttb");
+    valid = havettb && !ReadManifest(&old, manpath) && !strcmp(old.settings, man.settings) && keyequal(&old.ttb, &ttbkey);
 
-  txtfp = fopen(txtpath, "r");
+    if (valid && keyequal(&old.txt, &man.txt))
+    {
+      printf("%s: %i records, unchanged (%.2f s)\n", ttbpath, old.numrecords, wallclock()-start);
+      free(old.records);
+      return;
+    }
+  }
+
+  txtfp = fopen(txtpath, "rb");
   if (!txtfp)
     Error("TXT2TTB: Failed to open input  TXT file '%s'", txtpath);
 
-  // first line in TXT should be number of records to be included in TTB file
-  fgets(linebuf, MAXSTRING, txtfp);
+  memset(&arena, 0, sizeof(arena_t));
+  for (;;)
+  {
+    arena_reserve(&arena, 65536);
+    n = fread(arena.data+arena.len, 1, arena.size-arena.len-1, txtfp);
+    if (!n)
+      break;
+    arena.len += n;
+  }
+
+  if (ferror(txtfp))
+    Error("TXT2TTB: Failed to read input TXT file '%s'", txtpath);
+  fclose(txtfp);
+
+  arena.data[arena.len] = 0;
 
+  // first line in TXT should be number of records to be included in TTB file
   // windows notepad may put this crap at the beginning of the file when saved as UTF-8...
-  if (!memcmp(linebuf,"\xEF\xBB\xBF",3))
-    r = sscanf(linebuf+3, "%i\n", &numrecords);
+  if (!memcmp(arena.data,"\xEF\xBB\xBF",3))
+    r = sscanf(arena.data+3, "%i", &numrecords);
   else
-    r = sscanf(linebuf, "%i\n", &numrecords);
+    r = sscanf(arena.data, "%i", &numrecords);
 
   if (r < 1)
     Error("TXT2TTB: Parse error (expected count of records)");
 
-  if (numrecords < 0 || numrecords > MAXRECORDS)
+  if (numrecords < 0 || (size_t)numrecords > arena.len/2)
     Error("bad record count on first line (TXT not generated by DumpTTB?)");
-  
-  // skip separator line
-  fgets(linebuf, MAXSTRING, txtfp);
 
-  tmprecs = malloc(sizeof(tmprec_t)*numrecords);
+  // make room for the header and record table in front of the text
+  headlen = sizeof(ttbhead_t) + (size_t)numrecords*sizeof(ttbrec_t);
+  arena_reserve(&arena, headlen);
+  memmove(arena.data+headlen, arena.data, arena.len+1);
+  arena.len += headlen;
+
+  pos = arena.data+headlen;
+  end = arena.data+arena.len;
+
+  // skip count and separator lines
+  nextline(&pos, end);
+  nextline(&pos, end);
+
+  tmprecs = malloc(sizeof(tmprec_t)*(numrecords+1));
   if (!tmprecs)
     Error("failed to allocate memory for string record table");
 
-  offset = sizeof(ttbhead_t) + numrecords*sizeof(ttbrec_t);
+  ttbhead.unknown1 = 0x8;
+  ttbhead.unknown2 = 0x10;
+  memcpy(arena.data, &ttbhead, sizeof(ttbhead_t));
+
+  offset = headlen;
 
   // then follow all the records, 2 lines per record + separator
   for (i=0; i<numrecords; i++)
   {
-    int index;
     uint32_t u1,u2,u3;
+    byte *line;
     int len;
 
-    fgets(linebuf, MAXSTRING, txtfp);
-    
-    r = sscanf(linebuf, "%08X %08X %08X\n", &u1, &u2, &u3);
-    if (r < 3)
-      Error("failed to read string id / unknown data, wrong item count (TXT not generated by DumpTTB?) #2");
-    
-    fgets(linebuf, MAXSTRING, txtfp);
+    line = nextline(&pos, end);
+    if (!line || sscanf(line, "%08X %08X %08X", &u1, &u2, &u3) < 3)
+      Error("failed to read string id / unknown data of record %i, wrong item count (TXT not generated by DumpTTB?)", i);
 
-    tmprecs[i].string = malloc(strlen(linebuf)+1);
-    if (!tmprecs[i].string)
-      Error("failed to allocate memory for string");
+    line = nextline(&pos, end);
+    if (!line)
+      Error("TXT2TTB: Unexpected end of TXT file in record %i", i);
 
-    len = readstring(tmprecs[i].string, linebuf); // handle escapes
+    // the string starts at least at offset in the arena, so it can be unescaped onto it
+    tmprecs[i].string = arena.data+offset;
+    len = readstring(tmprecs[i].string, line); // handle escapes
     tmprecs[i].offset = offset;
     tmprecs[i].length = len;
     offset += len+1;
-    
+
+    if (offset > INT32_MAX) // the record offsets are signed
+      Error("TXT2TTB: TTB data would be over 2 GB");
+
     tmprecs[i].u1 = u1; tmprecs[i].u2 = u2; tmprecs[i].u3 = u3;
 
+    ttbrec.unknown1 = u1; ttbrec.unknown2 = u2; ttbrec.unknown3 = u3;
+    ttbrec.offset = tmprecs[i].offset;
+    memcpy(arena.data+sizeof(ttbhead_t)+i*sizeof(ttbrec_t), &ttbrec, sizeof(ttbrec_t));
+
     // skip separator line
     if (i < numrecords-1)
-      fgets(linebuf, MAXSTRING, txtfp);
+      nextline(&pos, end);
   }
 
-  ttbhead.unknown1 = 0x8;
-  ttbhead.unknown2 = 0x10;
-  
-  ulen = sizeof(ttbhead_t); // main TTB header, always present
-  ulen += sizeof(ttbrec_t)*numrecords;
+  ttbdata = arena.data;
+  ulen = offset;
 
-  for (i=0; i<numrecords; i++)
-    ulen += tmprecs[i].length+1;
+  if (incremental)
+  {
+    char ids[32];
 
-  ttbdata = malloc(ulen);
-  if (!ttbdata)
-    Error("failed to allocate memory for TTB data buffer");
+    man.numrecords = numrecords;
+    man.records = malloc(sizeof(cachekey_t)*(numrecords+1));
+    if (!man.records)
+      Error("failed to allocate memory for record hashes");
 
-  memcpy(ttbdata, &ttbhead, sizeof(ttbhead_t));
+    // the offsets follow from the strings before, so only ids and strings are hashed
+    changed = 0;
+    for (i=0; i<numrecords; i++)
+    {
+      snprintf(ids, sizeof(ids), "%08X %08X %08X", tmprecs[i].u1, tmprecs[i].u2, tmprecs[i].u3);
+      cache_key_buffer(&man.records[i], tmprecs[i].string, tmprecs[i].length, ids);
 
-  for (i=0; i<numrecords; i++)
-  {
-    ttbrec.offset = tmprecs[i].offset;
-    
-    ttbrec.unknown1 = tmprecs[i].u1; ttbrec.unknown2 = tmprecs[i].u2; ttbrec.unknown3 = tmprecs[i].u3;
+      if (!valid || i >= old.numrecords || !keyequal(&man.records[i], &old.records[i]))
+        changed++;
+    }
 
-    memcpy(ttbdata+sizeof(ttbhead_t)+i*sizeof(ttbrec_t), &ttbrec, sizeof(ttbrec_t));
-    memcpy(ttbdata+tmprecs[i].offset, tmprecs[i].string, tmprecs[i].length);
+    if (valid && numrecords == old.numrecords && !changed)
+    {
+      man.ttb = old.ttb;
+      WriteManifest(&man, manpath);
+
+      printf("%s: %i records, none changed (%.2f s)\n", ttbpath, numrecords, wallclock()-start);
+
+      free(arena.data);
+      free(tmprecs);
+      free(man.records);
+      free(old.records);
+      return;
+    }
+
+    if (valid && old.numrecords > numrecords)
+      changed += old.numrecords-numrecords;
+    snprintf(changes, sizeof(changes), " (%i changed)", changed);
   }
 
-  clen = compressBound(ulen);
+  if (pack)
+  {
+    ulen = PackTTB(arena.data, tmprecs, numrecords, headlen, &shared);
+    snprintf(changes+strlen(changes), sizeof(changes)-strlen(changes), ", %i shared", shared);
+  }
+
+  clen = zback_bound(ulen);
   zdata = malloc(clen+sizeof(uint32_t));
   if (!zdata)
     Error("failed to allocate memory for compressed TTB data buffer");
 
+  zlen = clen;
   memcpy(zdata, &ulen, sizeof(uint32_t));
-  r = compress2(zdata+sizeof(uint32_t), (uLongf*)&clen, ttbdata, ulen, 9);
+  r = zback_compress(zdata+sizeof(uint32_t), &zlen, ttbdata, ulen, zback_level());
+  clen = zlen;
   if (r != Z_OK)
     Error("zlib compression for TTB data failed (code %i)\n", r);
 
   key = inti_keygen("txt20170401");
   inti_encdec(zdata, MODE_ENC, clen+sizeof(uint32_t), key);
 
-  fwrite(zdata, 1, clen+sizeof(uint32_t), ttbfp);
+  if (incremental)
+    cache_key_buffer(&man.ttb, zdata, clen+sizeof(uint32_t), "textconv ttb");
 
-  fclose(ttbfp);
-  fclose(txtfp);
+  // leave a TTB that would come out the same alone, mtime and all
+  if (incremental && havettb && keyequal(&man.ttb, &ttbkey))
+    snprintf(changes+strlen(changes), sizeof(changes)-strlen(changes), ", identical");
+  else
+  {
+    remove(ttbpath); // may be a hardlink into the conversion cache
+    ttbfp = fopen(ttbpath, "wb");
+    if (!ttbfp)
+      Error("TXT2TTB: Failed to open output TTB file '%s'", ttbpath);
 
-  free(zdata);
-  free(ttbdata);
+    if (fwrite(zdata, 1, clen+sizeof(uint32_t), ttbfp) != clen+sizeof(uint32_t) || fclose(ttbfp))
+      Error("TXT2TTB: Failed to write output TTB file '%s'", ttbpath);
+  }
 
-  for(i=0; i<numrecords; i++)
-    free(tmprecs[i].string);
-  
+  if (incremental)
+    WriteManifest(&man, manpath);
+
+  printf("%s: %i records%s, %u => %u bytes, %s (%.2f s)\n", ttbpath, numrecords, changes, ulen,
+         clen+(uint32_t)sizeof(uint32_t), zback_describe(), wallclock()-start);
+
+  free(zdata);
+  free(arena.data);
   free(tmprecs);
+  free(man.records);
+  free(old.records);
 }
 
 int main (int argc, char **argv)
 {
   char command;
+  char settings[96], deflate[64];
+  cachekey_t cachekey;
+  int caching, incremental, pack;
+
+  if (getenv("INTI_CACHE") && *getenv("INTI_CACHE") && cache_set_dir(getenv("INTI_CACHE")))
+    Error("failed to create cache directory '%s'", getenv("INTI_CACHE"));
+
+  // options in front of the command: -z <backend>, -l <level>, -s <strategy>, -c <cachedir>, -i, -p
+  incremental = pack = 0;
+  while (argc > 2 && argv[1][0] == '-')
+  {
+    if (!strcmp(argv[1], "-i") || !strcmp(argv[1], "-p"))
+    {
+      if (argv[1][1] == 'i')
+        incremental = 1;
+      else
+        pack = 1;
+
+      argv++;
+      argc--;
+      continue;
+    }
+    else if (!strcmp(argv[1], "-z"))
+    {
+      if (zback_select(argv[2]))
+        Error("deflate backend '%s' is unknown or not compiled in", argv[2]);
+    }
+    else if (!strcmp(argv[1], "-l"))
+    {
+      if (zback_set_level(argv[2]))
+        Error("bad compression level '%s' (0-9, 0-12 with libdeflate, store, fast, default, max, search)", argv[2]);
+    }
+    else if (!strcmp(argv[1], "-s"))
+    {
+      if (zback_set_strategy(argv[2]))
+        Error("bad compression strategy '%s' (default, filtered, huffman, rle, fixed)", argv[2]);
+    }
+    else if (!strcmp(argv[1], "-c"))
+    {
+      if (cache_set_dir(argv[2]))
+        Error("failed to create cache directory '%s'", argv[2]);
+    }
+    else
+      break;
+
+    argv += 2;
+    argc -= 2;
+  }
 
   if (argc < 3)
   {
-    printf("usage: textconv <e/d> <infile> <outfile>\n");
+    printf("usage: textconv [-z <zlib/zlib-ng/libdeflate>] [-l <level/store/fast/max/search>] [-s <strategy>] [-c <cachedir>] [-i] [-p] <e/d> <infile> <outfile>\n");
     return -1;
   }
 
   command = toupper(argv[1][0]);
 
+  // an unchanged input converted the same way before is taken from the cache.
+  // incremental encodes keep their own manifest instead, as a hit would replace
+  // the TTB even when it's already the same
+  caching = 0;
+  if (cache_enabled() && (command == 'D' || (command == 'E' && !incremental)))
+  {
+    uint64_t size;
+
+    if (command == 'D')
+      snprintf(settings, sizeof(settings), "textconv d");
+    else
+      snprintf(settings, sizeof(settings), "textconv e %s%s", cache_deflate_settings(deflate, sizeof(deflate)), pack ? " packed" : "");
+
+    if (!cache_key_file(&cachekey, argv[2], settings))
+    {
+      if (!cache_fetch(&cachekey, argv[3], &size))
+      {
+        printf("%s: from cache, %u bytes\n", argv[3], (unsigned int)size);
+        return 0;
+      }
+
+      caching = 1;
+    }
+  }
+
   if (command == 'D')
     TTB2TXT(argv[3],argv[2]);
   else if (command=='E')
-    TXT2TTB(argv[3],argv[2]);
+    TXT2TTB(argv[3],argv[2],incremental,pack);
   else
   {
-    printf("usage: textconv <e/d> <infile> <outfile>\n");
+    printf("usage: textconv [-z <zlib/zlib-ng/libdeflate>] [-l <level/store/fast/max/search>] [-s <strategy>] [-c <cachedir>] [-i] [-p] <e/d> <infile> <outfile>\n");
     return -1;
   }
 
+  if (caching)
+    cache_store(&cachekey, argv[3]);
+
   return 0;
 }
@@ -0,0 +1,57 @@
+//
+// portable threads, header
+//
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+typedef void (*threadfunc_t)(void *arg);
+
+#ifdef _WIN32
+  typedef CRITICAL_SECTION mutex_t;
+  typedef CONDITION_VARIABLE cond_t;
+
+  typedef struct
+  {
+    HANDLE th;
+    threadfunc_t func;
+    void *arg;
+  }
+  thread_t;
+#else // not _WIN32
+  typedef pthread_mutex_t mutex_t;
+  typedef pthread_cond_t cond_t;
+
+  typedef struct
+  {
+    pthread_t th;
+    threadfunc_t func;
+    void *arg;
+  }
+  thread_t;
+#endif
+
+extern int thread_start(thread_t *t, threadfunc_t func, void *arg); // returns 0 on success
+extern void thread_join(thread_t *t);
+
+extern void mutex_init(mutex_t *m);
+extern void mutex_lock(mutex_t *m);
+extern void mutex_unlock(mutex_t *m);
+extern void mutex_destroy(mutex_t *m);
+
+extern void cond_init(cond_t *c);
+extern void cond_wait(cond_t *c, mutex_t *m); // m must be locked, may wake up spuriously
+extern void cond_broadcast(cond_t *c);
+extern void cond_destroy(cond_t *c);
+
+extern int cpu_count(void); // number of online logical processors, at least 1
+extern double wallclock(void); // monotonic seconds, for timing output
+
+#endif // __THREADS_H__
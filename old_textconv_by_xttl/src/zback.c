@@ -0,0 +1,368 @@
+//
+// pluggable deflate/inflate backends
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifndef _MSC_VER
+ #include <strings.h>
+ #define stricmp strcasecmp
+#endif
+
+#ifdef INTI_HAVE_ZLIBNG
+ #include <zlib-ng.h>
+#endif
+#ifdef INTI_HAVE_LIBDEFLATE
+ #include <libdeflate.h>
+#endif
+
+#include "pzlib.h"
+#include "zsearch.h"
+#include "zback.h"
+
+static int backend = INTI_DEFAULT_ZBACK;
+static int complevel = ZBACK_LEVEL_DEFAULT;
+static int compstrategy = Z_DEFAULT_STRATEGY;
+static char description[64];
+
+static const char *backendnames[ZBACK_COUNT] = { "zlib", "zlib-ng", "libdeflate" };
+
+static const struct
+{
+  const char *name;
+  int level;
+}
+levelnames[] =
+{
+  { "store",   ZBACK_LEVEL_STORE },
+  { "fast",    ZBACK_LEVEL_FAST },
+  { "default", ZBACK_LEVEL_DEFAULT },
+  { "max",     ZBACK_LEVEL_MAX },
+  { "search",  ZBACK_LEVEL_SEARCH }
+};
+
+static const struct
+{
+  const char *name;
+  int strategy;
+}
+strategynames[] =
+{
+  { "default",  Z_DEFAULT_STRATEGY },
+  { "filtered", Z_FILTERED },
+  { "huffman",  Z_HUFFMAN_ONLY },
+  { "rle",      Z_RLE },
+  { "fixed",    Z_FIXED }
+};
+
+const char *zback_name (int b)
+{
+  return (b >= 0 && b < ZBACK_COUNT) ? backendnames[b] : "?";
+}
+
+int zback_available (int b)
+{
+  switch (b)
+  {
+    case ZBACK_ZLIB:
+      return 1;
+#ifdef INTI_HAVE_ZLIBNG
+    case ZBACK_ZLIBNG:
+      return 1;
+#endif
+#ifdef INTI_HAVE_LIBDEFLATE
+    case ZBACK_LIBDEFLATE:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+int zback_select (const char *name)
+{
+  int b;
+
+  for (b=0; b<ZBACK_COUNT; b++)
+  {
+    if (!stricmp(name, backendnames[b]) && zback_available(b))
+    {
+      backend = b;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int zback_current (void)
+{
+  return backend;
+}
+
+int zback_set_level (const char *name)
+{
+  char *end;
+  long l;
+  int i;
+
+  for (i=0; i<(int)(sizeof(levelnames)/sizeof(levelnames[0])); i++)
+  {
+    if (!stricmp(name, levelnames[i].name))
+    {
+      complevel = levelnames[i].level;
+      return 0;
+    }
+  }
+
+  l = strtol(name, &end, 10);
+  if (!*name || *end || l < 0 || l > ZBACK_LEVEL_MAX)
+    return -1;
+
+  complevel = l;
+  return 0;
+}
+
+int zback_set_strategy (const char *name)
+{
+  int i;
+
+  for (i=0; i<(int)(sizeof(strategynames)/sizeof(strategynames[0])); i++)
+  {
+    if (!stricmp(name, strategynames[i].name))
+    {
+      compstrategy = strategynames[i].strategy;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int zback_level (void)
+{
+  if (complevel > 9 && complevel != ZBACK_LEVEL_SEARCH && backend != ZBACK_LIBDEFLATE)
+    return 9;
+
+  return complevel;
+}
+
+int zback_strategy (void)
+{
+  return compstrategy;
+}
+
+const char *zback_describe (void)
+{
+  if (complevel != ZBACK_LEVEL_SEARCH)
+    snprintf(description, sizeof(description), "level %i", zback_level());
+  else if (!description[0])
+    snprintf(description, sizeof(description), "search");
+
+  return description;
+}
+
+static size_t bound_with (int b, size_t sourcelen)
+{
+  size_t bound;
+
+  bound = pz_compressBound(sourcelen);
+
+#ifdef INTI_HAVE_ZLIBNG
+  if (b == ZBACK_ZLIBNG && zng_compressBound(sourcelen) > bound)
+    bound = zng_compressBound(sourcelen);
+#endif
+#ifdef INTI_HAVE_LIBDEFLATE
+  if (b == ZBACK_LIBDEFLATE)
+  {
+    struct libdeflate_compressor *c = libdeflate_alloc_compressor(1);
+
+    if (c)
+    {
+      if (libdeflate_zlib_compress_bound(c, sourcelen) > bound)
+        bound = libdeflate_zlib_compress_bound(c, sourcelen);
+      libdeflate_free_compressor(c);
+    }
+  }
+#endif
+
+  (void)b;
+  return bound;
+}
+
+static int compress_with (int b, uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int level, int numthreads)
+{
+  uLongf zlen;
+  int r;
+
+  switch (b)
+  {
+#ifdef INTI_HAVE_ZLIBNG
+    case ZBACK_ZLIBNG:
+      return zng_compress2(dest, destlen, source, sourcelen, level > 9 ? 9 : level);
+#endif
+
+#ifdef INTI_HAVE_LIBDEFLATE
+    case ZBACK_LIBDEFLATE:
+    {
+      struct libdeflate_compressor *c;
+      size_t n;
+
+      c = libdeflate_alloc_compressor(level > 12 ? 12 : level);
+      if (!c)
+        return Z_MEM_ERROR;
+
+      n = libdeflate_zlib_compress(c, source, sourcelen, dest, *destlen);
+      libdeflate_free_compressor(c);
+
+      if (!n)
+        return Z_BUF_ERROR;
+
+      *destlen = n;
+      return Z_OK;
+    }
+#endif
+
+    default:
+      zlen = *destlen;
+      r = pz_compress2(dest, &zlen, source, sourcelen, level > 9 ? 9 : level, compstrategy, numthreads);
+      *destlen = zlen;
+      return r;
+  }
+}
+
+static int uncompress_with (int b, uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen)
+{
+  uLongf ulen;
+  int r;
+
+  switch (b)
+  {
+#ifdef INTI_HAVE_ZLIBNG
+    case ZBACK_ZLIBNG:
+      return zng_uncompress(dest, destlen, source, sourcelen);
+#endif
+
+#ifdef INTI_HAVE_LIBDEFLATE
+    case ZBACK_LIBDEFLATE:
+    {
+      struct libdeflate_decompressor *d;
+      enum libdeflate_result lr;
+
+      d = libdeflate_alloc_decompressor();
+      if (!d)
+        return Z_MEM_ERROR;
+
+      lr = libdeflate_zlib_decompress(d, source, sourcelen, dest, *destlen, destlen);
+      libdeflate_free_decompressor(d);
+
+      if (lr == LIBDEFLATE_SUCCESS)
+        return Z_OK;
+
+      return (lr == LIBDEFLATE_INSUFFICIENT_SPACE) ? Z_BUF_ERROR : Z_DATA_ERROR;
+    }
+#endif
+
+    default:
+      ulen = *destlen;
+      r = uncompress(dest, &ulen, source, sourcelen);
+      *destlen = ulen;
+      return r;
+  }
+}
+
+size_t zback_bound (size_t sourcelen)
+{
+  return bound_with(backend, sourcelen);
+}
+
+int zback_compress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int level)
+{
+  return zback_compress_threads(dest, destlen, source, sourcelen, level, 0);
+}
+
+int zback_compress_threads (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int level, int numthreads)
+{
+  const char *winner;
+  int r;
+
+  if (level != ZBACK_LEVEL_SEARCH)
+    return compress_with(backend, dest, destlen, source, sourcelen, level, numthreads);
+
+  r = zsearch_compress(dest, destlen, source, sourcelen, numthreads, &winner);
+  if (r == Z_OK)
+    snprintf(description, sizeof(description), "search, %s won", winner);
+
+  return r;
+}
+
+int zback_uncompress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen)
+{
+  return uncompress_with(backend, dest, destlen, source, sourcelen);
+}
+
+int zback_selftest (const uint8_t *data, size_t len, int level)
+{
+  uint8_t *zbuf, *ubuf;
+  size_t zlen, ulen;
+  int cb, db, r, failed;
+
+  failed = 0;
+
+  ubuf = malloc(len ? len : 1);
+  if (!ubuf)
+    return -1;
+
+  for (cb=0; cb<ZBACK_COUNT; cb++)
+  {
+    if (!zback_available(cb))
+      continue;
+
+    zlen = bound_with(cb, len);
+    zbuf = malloc(zlen);
+    if (!zbuf)
+    {
+      free(ubuf);
+      return -1;
+    }
+
+    r = compress_with(cb, zbuf, &zlen, data, len, level, 0);
+    if (r != Z_OK)
+    {
+      printf("%-10s compress failed, error code %i\n", zback_name(cb), r);
+      failed = 1;
+      free(zbuf);
+      continue;
+    }
+
+    printf("%-10s compressed %zu => %zu bytes\n", zback_name(cb), len, zlen);
+
+    for (db=0; db<ZBACK_COUNT; db++)
+    {
+      if (!zback_available(db))
+        continue;
+
+      ulen = len;
+      r = uncompress_with(db, ubuf, &ulen, zbuf, zlen);
+
+      if (r != Z_OK || ulen != len || memcmp(ubuf, data, len))
+      {
+        printf("  %-10s -> %-10s MISMATCH (error code %i)\n", zback_name(cb), zback_name(db), r);
+        failed = 1;
+      }
+      else
+        printf("  %-10s -> %-10s ok\n", zback_name(cb), zback_name(db));
+    }
+
+    free(zbuf);
+  }
+
+  free(ubuf);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,61 @@
+//
+// pluggable deflate/inflate backends, header
+//
+// zlib is always there (and compresses large inputs in parallel through pzlib),
+// zlib-ng and libdeflate are compiled in with -DINTI_HAVE_ZLIBNG / -DINTI_HAVE_LIBDEFLATE
+//
+
+#ifndef __ZBACK_H__
+#define __ZBACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum
+{
+  ZBACK_ZLIB,
+  ZBACK_ZLIBNG,
+  ZBACK_LIBDEFLATE,
+  ZBACK_COUNT
+};
+
+#ifndef INTI_DEFAULT_ZBACK
+ #define INTI_DEFAULT_ZBACK ZBACK_ZLIB
+#endif
+
+// compression levels: 0 = stored blocks only, 9 = what the games ship with,
+// above 9 is only used by libdeflate (zlib and zlib-ng treat it as 9).
+// ZBACK_LEVEL_SEARCH tries many setups in parallel and keeps the smallest (zsearch.c)
+#define ZBACK_LEVEL_STORE 0
+#define ZBACK_LEVEL_FAST 1
+#define ZBACK_LEVEL_DEFAULT 9
+#define ZBACK_LEVEL_MAX 12
+#define ZBACK_LEVEL_SEARCH 13
+
+extern const char *zback_name (int backend);
+extern int zback_available (int backend);
+extern int zback_select (const char *name); // returns 0 on success, -1 if unknown or not compiled in
+extern int zback_current (void);
+
+// level is a number or one of store/fast/default/max/search, strategy one of
+// default/filtered/huffman/rle/fixed (zlib's, other backends ignore it).
+// both return 0 on success, -1 if the name is not known
+extern int zback_set_level (const char *name);
+extern int zback_set_strategy (const char *name);
+extern int zback_level (void); // capped to what the selected backend supports
+extern int zback_strategy (void); // as zlib Z_* constant
+extern const char *zback_describe (void); // "level 9", or which setup won the last search, for messages
+
+// zlib-format streams with the selected backend, return codes are zlib's Z_*
+extern size_t zback_bound (size_t sourcelen);
+extern int zback_compress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int level);
+// same, on at most numthreads threads (<= 0 means one per cpu), 1 keeps it on the
+// calling thread, for callers that already run on the thread pool
+extern int zback_compress_threads (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int level, int numthreads);
+extern int zback_uncompress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen);
+
+// compresses data with every available backend and decompresses each result with
+// every available backend, returns 0 if all of them give back the original bytes
+extern int zback_selftest (const uint8_t *data, size_t len, int level);
+
+#endif // __ZBACK_H__
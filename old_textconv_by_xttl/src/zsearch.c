@@ -0,0 +1,269 @@
+//
+// maximum compression search
+//
+// for release builds the download size matters more than encode time, so the
+// input is deflated with a whole list of setups at once (one pool job each),
+// every result is inflated again to make sure it is a valid zlib stream for
+// this input, and the smallest one wins. ties go to the earlier candidate, so
+// the output doesn't depend on thread timing
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef INTI_HAVE_ZLIBNG
+ #include <zlib-ng.h>
+#endif
+#ifdef INTI_HAVE_LIBDEFLATE
+ #include <libdeflate.h>
+#endif
+#ifdef INTI_HAVE_ZOPFLI
+ #include <zopfli/zopfli.h>
+#endif
+
+#include "threads.h"
+#include "pool.h"
+#include "zsearch.h"
+
+enum
+{
+  ZS_ZLIB,
+  ZS_ZLIB_EXHAUSTIVE, // level 9 with deflateTune() opened up to the full match search
+  ZS_ZLIBNG,
+  ZS_LIBDEFLATE,
+  ZS_ZOPFLI
+};
+
+typedef struct
+{
+  const char *name;
+  int kind;
+  int windowbits, memlevel, strategy;
+}
+candidate_t;
+
+// most expensive first, as pool_run() wants it
+static const candidate_t candidates[] =
+{
+#ifdef INTI_HAVE_ZOPFLI
+  { "zopfli",                    ZS_ZOPFLI,          15, 9, Z_DEFAULT_STRATEGY },
+#endif
+  { "zlib exhaustive",           ZS_ZLIB_EXHAUSTIVE, 15, 9, Z_DEFAULT_STRATEGY },
+  { "zlib exhaustive filtered",  ZS_ZLIB_EXHAUSTIVE, 15, 9, Z_FILTERED },
+#ifdef INTI_HAVE_LIBDEFLATE
+  { "libdeflate 12",             ZS_LIBDEFLATE,      15, 9, Z_DEFAULT_STRATEGY },
+#endif
+#ifdef INTI_HAVE_ZLIBNG
+  { "zlib-ng 9",                 ZS_ZLIBNG,          15, 8, Z_DEFAULT_STRATEGY },
+#endif
+  { "zlib 9",                    ZS_ZLIB,            15, 8, Z_DEFAULT_STRATEGY },
+  { "zlib 9 mem9",               ZS_ZLIB,            15, 9, Z_DEFAULT_STRATEGY },
+  { "zlib 9 filtered",           ZS_ZLIB,            15, 8, Z_FILTERED },
+  { "zlib 9 filtered mem9",      ZS_ZLIB,            15, 9, Z_FILTERED },
+  { "zlib 9 window14",           ZS_ZLIB,            14, 9, Z_DEFAULT_STRATEGY },
+  { "zlib 9 window14 filtered",  ZS_ZLIB,            14, 9, Z_FILTERED },
+  { "zlib 9 window13",           ZS_ZLIB,            13, 9, Z_DEFAULT_STRATEGY },
+  { "zlib 9 fixed",              ZS_ZLIB,            15, 9, Z_FIXED },
+  { "zlib 9 rle",                ZS_ZLIB,            15, 9, Z_RLE },
+  { "zlib huffman",              ZS_ZLIB,            15, 9, Z_HUFFMAN_ONLY }
+};
+
+#define NUMCANDIDATES ((int)(sizeof(candidates)/sizeof(candidates[0])))
+
+typedef struct
+{
+  const uint8_t *source;
+  size_t sourcelen;
+
+  uint8_t *best;
+  size_t bestlen;
+  int bestindex;
+  int result; // zlib code of the first failure, only reported if nothing worked
+
+  mutex_t lock;
+}
+zsearch_t;
+
+static int deflate_zlib (const candidate_t *c, uint8_t **out, size_t *outlen, const uint8_t *source, size_t sourcelen)
+{
+  z_stream zs;
+  uLong bound;
+  int r;
+
+  memset(&zs, 0, sizeof(zs));
+  r = deflateInit2(&zs, 9, Z_DEFLATED, c->windowbits, c->memlevel, c->strategy);
+  if (r != Z_OK)
+    return r;
+
+  // good_length, max_lazy, nice_length, max_chain: never cut the search short
+  if (c->kind == ZS_ZLIB_EXHAUSTIVE)
+    deflateTune(&zs, 258, 258, 258, 32768);
+
+  bound = deflateBound(&zs, sourcelen);
+  *out = malloc(bound);
+  if (!*out)
+  {
+    deflateEnd(&zs);
+    return Z_MEM_ERROR;
+  }
+
+  zs.next_in = (Bytef*)source;
+  zs.avail_in = sourcelen;
+  zs.next_out = *out;
+  zs.avail_out = bound;
+
+  r = deflate(&zs, Z_FINISH);
+  *outlen = zs.total_out;
+  deflateEnd(&zs);
+
+  return (r == Z_STREAM_END) ? Z_OK : (r == Z_OK) ? Z_BUF_ERROR : r;
+}
+
+static int deflate_candidate (const candidate_t *c, uint8_t **out, size_t *outlen, const uint8_t *source, size_t sourcelen)
+{
+  *out = NULL;
+
+  switch (c->kind)
+  {
+#ifdef INTI_HAVE_ZLIBNG
+    case ZS_ZLIBNG:
+      *outlen = zng_compressBound(sourcelen);
+      *out = malloc(*outlen);
+      if (!*out)
+        return Z_MEM_ERROR;
+
+      return zng_compress2(*out, outlen, source, sourcelen, 9);
+#endif
+
+#ifdef INTI_HAVE_LIBDEFLATE
+    case ZS_LIBDEFLATE:
+    {
+      struct libdeflate_compressor *ld;
+
+      ld = libdeflate_alloc_compressor(12);
+      if (!ld)
+        return Z_MEM_ERROR;
+
+      *outlen = libdeflate_zlib_compress_bound(ld, sourcelen);
+      *out = malloc(*outlen);
+      if (*out)
+        *outlen = libdeflate_zlib_compress(ld, source, sourcelen, *out, *outlen);
+      libdeflate_free_compressor(ld);
+
+      if (!*out)
+        return Z_MEM_ERROR;
+
+      return *outlen ? Z_OK : Z_BUF_ERROR;
+    }
+#endif
+
+#ifdef INTI_HAVE_ZOPFLI
+    case ZS_ZOPFLI:
+    {
+      ZopfliOptions options;
+
+      if (sourcelen > ZSEARCH_ZOPFLI_MAX)
+        return Z_BUF_ERROR;
+
+      ZopfliInitOptions(&options);
+      *outlen = 0;
+      ZopfliCompress(&options, ZOPFLI_FORMAT_ZLIB, source, sourcelen, out, outlen);
+
+      return *out ? Z_OK : Z_MEM_ERROR;
+    }
+#endif
+
+    default:
+      return deflate_zlib(c, out, outlen, source, sourcelen);
+  }
+}
+
+// the games inflate with zlib, so that's what has to accept the stream
+static int verify (const uint8_t *zdata, size_t zlen, const uint8_t *source, size_t sourcelen)
+{
+  uint8_t *check;
+  uLongf checklen;
+  int r;
+
+  check = malloc(sourcelen ? sourcelen : 1);
+  if (!check)
+    return Z_MEM_ERROR;
+
+  checklen = sourcelen;
+  r = uncompress(check, &checklen, zdata, zlen);
+  if (r == Z_OK && (checklen != sourcelen || memcmp(check, source, sourcelen)))
+    r = Z_DATA_ERROR;
+
+  free(check);
+  return r;
+}
+
+static void zsearch_job (void *ctx, int index)
+{
+  zsearch_t *zs = ctx;
+  uint8_t *out;
+  size_t outlen;
+  int r;
+
+  r = deflate_candidate(&candidates[index], &out, &outlen, zs->source, zs->sourcelen);
+  if (r == Z_OK)
+    r = verify(out, outlen, zs->source, zs->sourcelen);
+
+  mutex_lock(&zs->lock);
+
+  if (r != Z_OK)
+  {
+    if (zs->result == Z_OK)
+      zs->result = r;
+  }
+  else if (!zs->best || outlen < zs->bestlen || (outlen == zs->bestlen && index < zs->bestindex))
+  {
+    free(zs->best);
+    zs->best = out;
+    zs->bestlen = outlen;
+    zs->bestindex = index;
+    out = NULL;
+  }
+
+  mutex_unlock(&zs->lock);
+
+  free(out);
+}
+
+int zsearch_compress (uint8_t *dest, size_t *destlen, const uint8_t *source, size_t sourcelen, int numthreads, const char **winner)
+{
+  zsearch_t zs;
+  int r;
+
+  memset(&zs, 0, sizeof(zs));
+  zs.source = source;
+  zs.sourcelen = sourcelen;
+  zs.bestindex = -1;
+  zs.result = Z_OK;
+
+  mutex_init(&zs.lock);
+  pool_run(numthreads, NUMCANDIDATES, zsearch_job, &zs);
+  mutex_destroy(&zs.lock);
+
+  if (!zs.best)
+    r = (zs.result != Z_OK) ? zs.result : Z_MEM_ERROR;
+  else if (zs.bestlen > *destlen)
+    r = Z_BUF_ERROR;
+  else
+  {
+    memcpy(dest, zs.best, zs.bestlen);
+    *destlen = zs.bestlen;
+
+    if (winner)
+      *winner = candidates[zs.bestindex].name;
+
+    r = Z_OK;
+  }
+
+  free(zs.best);
+  return r;
+}
@@ -1,9 +1,17 @@
+import re
 import sys
 import zlib
+import hashlib
 import struct
 from typing import List, Tuple
 from dataclasses import dataclass
 
+# компилированные ядра (old/python/_inti.c), если собраны
+try:
+    import _inti
+except ImportError:
+    _inti = None
+
 # Добавляем содержимое encdec.py в начало файла
 INTI_BASEKEY = 0xA1B34F58CAD705B2
 
@@ -11,6 +19,9 @@ MODE_ENC = 0
 MODE_DEC = 1
 
 def inti_keygen(keystr: str) -> int:
+    if _inti:
+        return _inti.keygen(keystr)
+
     key = INTI_BASEKEY
     
     for c in keystr:
@@ -20,6 +31,10 @@ def inti_keygen(keystr: str) -> int:
     return key & 0xFFFFFFFFFFFFFFFF
 
 def inti_encdec(buffer: bytearray, mode: int, key: int) -> None:
+    if _inti:
+        _inti.encdec(buffer, mode, key)
+        return
+
     blockkey = key
     
     for i in range(len(buffer)):
@@ -50,28 +65,30 @@ def error(msg: str, *args):
     print(msg % args)
     sys.exit(-1)
 
+# Экранируемые символы: управляющие, 0x7F и обратная косая черта. Регулярные
+# выражения находят их и копируют участки между ними целиком, а не по символу
+ESCAPE_RE = re.compile('[\x00-\x1F\x7F\\\\]')
+UNESCAPE_RE = re.compile(r'\\(x[0-9A-Fa-f]{2}|.)', re.S)
+
+ESCAPES = {'\n': '\\n', '\r': '\\r', '\t': '\\t', '\b': '\\b', '\\': '\\\\'}
+UNESCAPES = {'n': ord('\n'), 'r': ord('\r'), 't': ord('\t'), 'b': ord('\b'), '\\': ord('\\')}
+
+def escape_char(m) -> str:
+    char = m.group()
+    return ESCAPES.get(char) or f'\\x{ord(char):02X}'
+
 def write_string(f, data: bytes) -> None:
     try:
         # Пробуем декодировать как UTF-8
         text = data.decode('utf-8')
-        for char in text:
-            if char == '\n':
-                f.write('\\n')
-            elif char == '\r':
-                f.write('\\r')
-            elif char == '\t':
-                f.write('\\t')
-            elif char == '\b':
-                f.write('\\b')
-            elif ord(char) < 0x20 or ord(char) == 0x7F:
-                f.write(f'\\x{ord(char):02X}')
-            else:
-                f.write(char)
+        f.write(ESCAPE_RE.sub(escape_char, text))
     except UnicodeDecodeError:
         # Если не получилось декодировать как UTF-8, обрабатываем побайтово
         for b in data:
             if b < 0x20 or b == 0x7F:
                 f.write(f'\\x{b:02X}')
+            elif b == 0x5C:
+                f.write('\\\\')
             else:
                 try:
                     f.write(bytes([b]).decode('utf-8'))
@@ -92,15 +109,12 @@ def dump_ttb(outfile, ttb_data: bytes):
               header.unknown1, header.unknown2)
 
     # Читаем записи
-    while pos < len(ttb_data):
+    while pos + 16 <= len(ttb_data):
         rec = TTBRecord(*struct.unpack('<IIII', ttb_data[pos:pos+16]))
         if not (32 < rec.offset < len(ttb_data)):
             break
         records.append(rec)
         pos += 16
-        
-        if len(records) > 512:
-            error("Too many records")
 
     # Читаем строки
     for rec in records:
@@ -119,33 +133,24 @@ def dump_ttb(outfile, ttb_data: bytes):
 
 def read_string(s: str) -> bytes:
     result = bytearray()
-    i = 0
-    while i < len(s):
-        if s[i] == '\\':
-            if s[i+1] == 'n':
-                result.append(ord('\n'))
-                i += 2
-            elif s[i+1] == 'r':
-                result.append(ord('\r'))
-                i += 2
-            elif s[i+1] == 't':
-                result.append(ord('\t'))
-                i += 2
-            elif s[i+1] == 'b':
-                result.append(ord('\b'))
-                i += 2
-            elif s[i+1] == 'x':
-                hex_str = s[i+2:i+4]
-                result.append(int(hex_str, 16))
-                i += 4
-            else:
-                error("Bad escape sequence")
+    pos = 0
+    for m in UNESCAPE_RE.finditer(s):
+        # Участок до экранирования кодируем как UTF-8 целиком
+        result.extend(s[pos:m.start()].encode('utf-8'))
+
+        escape = m.group(1)
+        if escape[0] == 'x' and len(escape) == 3:
+            result.append(int(escape[1:], 16))
+        elif escape in UNESCAPES:
+            result.append(UNESCAPES[escape])
         else:
-            # Обрабатываем символ как UTF-8
-            char = s[i]
-            char_bytes = char.encode('utf-8')
-            result.extend(char_bytes)
-            i += 1
+            error("Bad escape sequence")
+        pos = m.end()
+
+    if s.endswith('\\', pos):
+        error("Bad escape sequence")
+
+    result.extend(s[pos:].encode('utf-8'))
     return bytes(result)
 
 
@@ -168,8 +173,67 @@ def ttb2txt(txt_path: str, ttb_path: str):
         
     dump_ttb(txt_path, decompressed)
 
-def txt2ttb(ttb_path: str, txt_path: str):    
+# Инкрементальная сборка (-i): <ttb>.manifest хранит хеши текстового файла,
+# каждой записи и собранного TTB, так что неизменённый TTB не перезаписывается
+MANIFEST_EXT = '.manifest'
+MANIFEST_MAGIC = 'textconv.py manifest 1'
+MANIFEST_SETTINGS = 'zlib 9'
+
+def digest(data: bytes) -> str:
+    return hashlib.blake2b(data, digest_size=16).hexdigest()
+
+def file_digest(path: str):
+    try:
+        with open(path, 'rb') as f:
+            return digest(f.read())
+    except OSError:
+        return None
+
+def read_manifest(path: str):
+    # None, если манифеста нет или он не подходит
+    try:
+        with open(path, 'r', encoding='ascii') as f:
+            lines = f.read().splitlines()
+    except (OSError, UnicodeDecodeError):
+        return None
+
+    if len(lines) < 5 or lines[0] != MANIFEST_MAGIC or lines[1] != 'settings ' + MANIFEST_SETTINGS:
+        return None
+
+    fields = [line.partition(' ') for line in lines[2:]]
+    if [f[0] for f in fields[:3]] != ['txt', 'ttb', 'records'] or not fields[2][2].isdigit():
+        return None
+
+    records = [value for name, _, value in fields[3:] if name == 'record']
+    if len(records) != int(fields[2][2]) or len(fields) != 3 + len(records):
+        return None
+
+    return {'txt': fields[0][2], 'ttb': fields[1][2], 'records': records}
+
+def write_manifest(path: str, txt_hash: str, ttb_hash: str, record_hashes: List[str]):
+    lines = [MANIFEST_MAGIC, 'settings ' + MANIFEST_SETTINGS,
+             'txt ' + txt_hash, 'ttb ' + ttb_hash, f'records {len(record_hashes)}']
+    lines += ['record ' + h for h in record_hashes]
+
+    with open(path, 'w', encoding='ascii', newline='\n') as f:
+        f.write('\n'.join(lines) + '\n')
+
+def txt2ttb(ttb_path: str, txt_path: str, incremental: bool = False):    
     records: List[TTBRecord] = []
+
+    if incremental:
+        manifest_path = ttb_path + MANIFEST_EXT
+        txt_hash = file_digest(txt_path)
+        ttb_hash = file_digest(ttb_path)
+
+        # Манифест действителен, только пока TTB тот же, для которого он записан
+        old = read_manifest(manifest_path)
+        if old and old['ttb'] != ttb_hash:
+            old = None
+
+        if old and old['txt'] == txt_hash:
+            print(f'{ttb_path}: {len(old["records"])} records, unchanged')
+            return
     
     with open(txt_path, 'r', encoding='utf-8') as f:
         # Читаем количество записей
@@ -178,7 +242,7 @@ def txt2ttb(ttb_path: str, txt_path: str):
             line = line[1:]
         num_records = int(line)
         
-        if not 0 <= num_records <= 512:
+        if num_records < 0:
             error("Bad record count")
             
         f.readline()  # Пропускаем пустую строку
@@ -194,6 +258,16 @@ def txt2ttb(ttb_path: str, txt_path: str):
             if _ < num_records - 1:
                 f.readline()  # Пропускаем разделитель
 
+    if incremental:
+        # Смещения следуют из предыдущих строк, поэтому хешируем только id и строку
+        record_hashes = [digest(struct.pack('<III', rec.unknown1, rec.unknown2, rec.unknown3) + rec.string)
+                         for rec in records]
+
+        if old and old['records'] == record_hashes:
+            write_manifest(manifest_path, txt_hash, old['ttb'], record_hashes)
+            print(f'{ttb_path}: {len(records)} records, none changed')
+            return
+
     # Формируем TTB данные
     ttb_data = bytearray()
     
@@ -228,23 +302,37 @@ def txt2ttb(ttb_path: str, txt_path: str):
     key = inti_keygen("txt20170401")
     inti_encdec(final_data, MODE_ENC, key)
     
+    if incremental and digest(final_data) == ttb_hash:
+        # Результат тот же - не трогаем файл (и его mtime)
+        write_manifest(manifest_path, txt_hash, ttb_hash, record_hashes)
+        print(f'{ttb_path}: {len(records)} records, identical')
+        return
+
     # Записываем результат
     with open(ttb_path, 'wb') as f:
         f.write(final_data)
 
+    if incremental:
+        write_manifest(manifest_path, txt_hash, digest(final_data), record_hashes)
+
 def main():
-    if len(sys.argv) != 4:
-        print("Usage: textconv.py <e/d> <infile> <outfile>")
+    args = sys.argv[1:]
+    incremental = args[:1] == ['-i']
+    if incremental:
+        args = args[1:]
+
+    if len(args) != 3:
+        print("Usage: textconv.py [-i] <e/d> <infile> <outfile>")
         return 1
         
-    command = sys.argv[1].upper()
+    command = args[0].upper()
     
     if command == 'D':
-        ttb2txt(sys.argv[3], sys.argv[2])
+        ttb2txt(args[2], args[1])
     elif command == 'E':
-        txt2ttb(sys.argv[3], sys.argv[2])
+        txt2ttb(args[2], args[1], incremental)
     else:
-        print("Usage: textconv.py <e/d> <infile> <outfile>")
+        print("Usage: textconv.py [-i] <e/d> <infile> <outfile>")
         return 1
         
     return 0